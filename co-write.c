@@ -8,12 +8,101 @@
 #include <unistd.h>
 #include <omp.h>
 #include <math.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-#define MAX_LINES 2555
 #define MAX_LINE_LENGTH 256
 #define MAX_USERNAME 50
 #define MAX_MESSAGE 256
 
+// Documento
+#define DEFAULT_LINES 2555            // linhas ao iniciar (--lines)
+#define MAX_DOC_LINES 999999          // maior documento aceito
+#define LINE_NUMBER_DIGITS 6          // largura da numeração "NNNNNN| " na visão (cobre MAX_DOC_LINES)
+#define STRUCTURE_HISTORY 64          // inserções/remoções lembradas para renumerar mensagens atrasadas
+#define DOC_BCAST_CHUNK (64 * 1024 * 1024) // bytes do arquivo por MPI_Bcast ao distribuir (--open)
+#define DEFAULT_SAVE_PATH "documento.txt" // destino de "Salvar" sem --save nem --open
+#define SAVE_BUFFER_SIZE (1 << 20)    // buffer de escrita ao salvar
+#define EXPORT_WRITE_CHUNK (64 * 1024 * 1024) // bytes por MPI_File_write_at_all ao exportar
+
+// Diário de escrita antecipada (--journal, só no rank 0)
+#define JOURNAL_SET 1                 // registro: substitui a linha
+#define JOURNAL_INSERT 2              // registro: insere a linha antes da posição
+#define JOURNAL_DELETE 3              // registro: remove a linha
+#define JOURNAL_RECORD_HEADER 24      // tamanho, soma, sequência (8 bytes), operação, linha
+#define JOURNAL_BUFFER_SIZE (64 * 1024) // buffer inicial dos registros ainda não gravados
+#define JOURNAL_SNAPSHOT_RECORDS 50000 // registros entre snapshots
+#define JOURNAL_SNAPSHOT_CHECK_MS 1000 // intervalo da verificação de snapshot na interface
+#define JOURNAL_SNAPSHOT_MAGIC "co-write snapshot" // primeira linha do snapshot, seguida da sequência
+
+// Anti-entropia (árvore de hashes sobre as linhas)
+#define MERKLE_BLOCK_LINES 64         // linhas por folha da árvore
+#define MERKLE_CHECK_MS 10000         // intervalo entre comparações com o rank 0 (--merkle-ms, 0 = desliga)
+#define MERKLE_MAX_NODES 4096         // nós por MSG_MERKLE (a resposta cabe em um quadro)
+#define MERKLE_MAX_BLOCKS 3           // blocos por MERKLE_BLOCK (as linhas de volta cabem em um quadro)
+
+// Motor de comunicação
+#define COMM_BROADCAST -1             // destino = todos os outros ranks
+#define COMM_RECV_SLOTS 8             // MPI_Irecv mantidos postados
+#define ENGINE_SPIN_ITERATIONS 200    // voltas de MPI_Testsome antes de dormir
+#define ENGINE_IDLE_MIN_US 50
+#define ENGINE_IDLE_MAX_US 1000
+#define COMM_MAX_INFLIGHT 64          // MPI_Isend simultâneos (pool limitado)
+#define COMM_MAX_INFLIGHT_PER_DEST 8  // limite por destino para isolar peers lentos
+#define COMM_HIGH_WATERMARK 4096      // mensagens pendentes que sinalizam backpressure
+#define COMM_RECV_BUF_SIZE (64 * 1024) // maior mensagem aceita no fio
+#define COMM_BATCH_MAX_BYTES COMM_RECV_BUF_SIZE
+#define SYNC_CHUNK_BYTES (COMM_RECV_BUF_SIZE - (int)sizeof(WireHeader) - 2 * (int)sizeof(int)) // bytes de snapshot por MSG_SYNC_DATA
+
+// Difusão para todos os ranks (--fanout=auto|linear|tree)
+#define FANOUT_AUTO 0                 // escolhe pelo número de ranks, uma vez por sessão
+#define FANOUT_LINEAR 1               // o originador envia uma cópia a cada rank
+#define FANOUT_TREE 2                 // árvore binomial: cada rank repassa aos seus filhos
+#define FANOUT_LINEAR_MAX_RANKS 8     // até aqui, auto envia direto
+#define FANOUT_TAG_BASE 1             // tag MPI de um quadro em árvore: base + raiz (0 = direto)
+#define FANOUT_MAX_RANKS 32766        // raiz + base cabe no mínimo garantido de MPI_TAG_UB
+
+// Canais de prioridade: um comunicador duplicado por canal, atendidos nessa ordem
+#define COMM_LANES 3
+#define LANE_CONTROL 0                // bloqueios, operações estruturais e coordenação
+#define LANE_DATA 1                   // conteúdo de linhas, lotes, snapshots, anti-entropia
+#define LANE_CHAT 2                   // chat e entradas de log
+#define LANE_SEND_RESERVE 8           // slots do pool de envio que só o controle usa
+
+// Resultado do envio assíncrono
+#define COMM_OK 0
+#define COMM_BACKPRESSURE 1
+
+// Fila de atualizações da interface
+#define UI_RING_SIZE 4096             // slots de Message pré-alocados (potência de 2)
+#define UI_DRAIN_MAX 4096             // mensagens aplicadas por quadro
+
+// Geração incremental
+#define GENERATION_RETRY_MS 5
+
+// Modo sem interface (--headless)
+#define HEADLESS_THINK_MS 200         // pausa entre ações da carga (--think-ms)
+#define HEADLESS_OPS 100              // edições da carga aleatória (--ops)
+#define HEADLESS_MAX_RANGE 8          // maior faixa pedida pela carga aleatória
+
+// Benchmark do protocolo (--bench)
+#define BENCH_ITERS 200               // medidas por rank em cada passo (--bench-iters)
+#define BENCH_CHAT_BURST 64           // mensagens de chat enviadas por volta do laço
+#define BENCH_LOCK_FREE 0             // cada rank bloqueia uma linha só sua
+#define BENCH_LOCK_CONTENDED 1        // todos os ranks disputam a mesma linha
+#define BENCH_UPDATE 2                // MSG_LINE_UPDATE do rank 0 até o eco de todos
+#define BENCH_CHAT 3                  // vazão do chat, todos enviando a todos
+#define BENCH_GENERATION 4            // geração OpenMP até todos aplicarem as linhas
+#define BENCH_OP_START 0              // rank 0 -> todos: começar o passo args[1]
+#define BENCH_OP_ECHO 1               // rank -> rank 0: atualização de medida aplicada
+#define BENCH_OP_SENT 2               // rank 0 -> todos: geração enviada (args[2] = linhas)
+#define BENCH_FORMAT_CSV 0
+#define BENCH_FORMAT_JSON 1
+
 // Tipos de mensagens MPI
 #define MSG_LINE_UPDATE 1
 #define MSG_LINE_LOCK_REQUEST 2
@@ -22,21 +111,209 @@
 #define MSG_LINE_UNLOCK 5
 #define MSG_CHAT 6
 #define MSG_LOG_ENTRY 7
+#define MSG_LINE_UPDATE_BATCH 8
+#define MSG_LINE_LOCK_OWNER 9         // home anuncia novo dono (args[0], -1 = livre)
+#define MSG_RANGE_LOCK 10             // interface -> motor local: bloquear [linha, args[0])
+#define MSG_RANGE_UNLOCK 11           // interface -> motor local: liberar [linha, args[0])
+#define MSG_LINE_LOCK_QUEUED 12       // home -> solicitante: pedido na fila (args[2] = posição)
+#define MSG_LINE_LOCK_CANCEL 13       // solicitante -> home: desiste do pedido args[1]
+#define MSG_RANGE_CANCEL 14           // interface <-> motor local: pedido cancelado
+#define MSG_LOCK_HEARTBEAT 15         // dono -> homes: renova a concessão de [linha, args[0])
+#define MSG_LINE_COMMIT 16            // editor -> home: commit otimista (args[0] = versão base)
+#define MSG_LINE_CONFLICT 17          // home -> editor: base desatualizada (args[0] = versão atual, args[1] = delta)
+#define MSG_LINE_SUBMIT_BATCH 18      // gerador -> home: lote que o home numera e difunde
+#define MSG_CRDT_INSERT 19            // modo CRDT: inserção de caracteres (ver crdt_receive)
+#define MSG_CRDT_DELETE 20            // modo CRDT: remoção de um caractere
+#define MSG_CRDT_ACK 21               // modo CRDT: vetor de operações já integradas por rank
+#define MSG_BENCH 22                  // controle do benchmark (args[0] = BENCH_OP_*)
+#define MSG_BENCH_REPORT 23           // rank -> rank 0: latências medidas no passo args[0]
+#define MSG_LINE_INSERT 24            // inserção de uma linha na posição line_number (content)
+#define MSG_LINE_DELETE 25            // remoção da linha line_number
+#define MSG_EXPORT 26                 // exportação coletiva MPI-IO para o arquivo em content
+#define MSG_SYNC_REQUEST 27           // rank -> doador: pede o documento e o estado das linhas
+#define MSG_SYNC_DATA 28              // doador -> rank: pedaço args[0] de args[1] do snapshot
+#define MSG_MERKLE 29                 // anti-entropia: comparação de hashes com o rank 0 (args[0] = etapa)
+#define MSG_LINE_DELTA 30             // MSG_LINE_UPDATE só com o trecho alterado em relação a uma base
+#define MSG_LINE_REFETCH 31           // rank -> autor: a base do delta não confere, pede a linha inteira
+#define MSG_RANK_LEAVE 32             // rank -> todos: saindo da sessão (na árvore, segue repassando)
+#define MSG_LINE_REFETCH_REPLY 33     // autor -> rank: a linha inteira pedida (args[3] = pedido)
+
+// Etapas de MSG_LINE_INSERT e MSG_LINE_DELETE (args[1])
+#define STRUCTURE_REQUEST 0           // solicitante -> rank 0: pedido, com a cauda já bloqueada
+#define STRUCTURE_APPLY 1             // rank 0 -> todos: operação ordenada, aplicar
+#define STRUCTURE_REJECT 2            // rank 0 -> solicitante: pedido sobre numeração antiga
+
+// Etapas de MSG_MERKLE (args[0])
+#define MERKLE_QUERY 0                // rank -> rank 0: índices de nós da árvore
+#define MERKLE_HASHES 1               // rank 0 -> rank: (nó, hash) de cada nó pedido
+#define MERKLE_BLOCK 2                // rank -> rank 0: bloco divergente e os hashes das suas linhas
+#define MERKLE_LINES 3                // rank 0 -> rank: versão e conteúdo das linhas que diferem
+
+// Etapas de MSG_EXPORT (args[0])
+#define EXPORT_REQUEST 0              // solicitante -> rank 0: exportar para content
+#define EXPORT_APPLY 1                // rank 0 -> todos: gravar a sua faixa (versão em args[1])
+#define EXPORT_DONE 2                 // motor -> interface local: resultado (args[1] = erro MPI)
+
+/*
+ * Argumentos das mensagens de bloqueio: args[0] é o fim (exclusivo) da faixa
+ * [line_number, args[0]) e args[1] o identificador do pedido, ecoado pelo home
+ * nas respostas; em MSG_LINE_LOCK_OWNER, args[0] é o dono e args[1] o fim da
+ * faixa, args[2] o token da concessão e args[3] = 1 se ela expirou e foi
+ * recolhida pelo home. MSG_LINE_LOCK_GRANTED do home leva o mesmo token em
+ * args[3]. Em MSG_RANGE_CANCEL para a interface, args[1] = 1 indica
+ * tempo esgotado. MSG_LINE_UPDATE e MSG_LINE_UPDATE_BATCH levam em args[0] o
+ * token sob o qual foram escritas (0 = linha livre, sem concessão); no modo
+ * otimista, MSG_LINE_UPDATE leva em args[1] a nova versão da linha.
+ * Inserir ou remover linhas renumera as seguintes. Cada rank conta as
+ * operações estruturais que já aplicou (a versão estrutural); mensagens com
+ * números de linha levam a versão da numeração usada: MSG_LINE_UPDATE em
+ * args[2], MSG_LINE_UPDATE_BATCH depois do token, MSG_LINE_LOCK_OWNER em
+ * args[4], MSG_RANGE_LOCK em args[1] e MSG_LINE_LOCK_REQUEST em args[2].
+ * Em MSG_LINE_INSERT e MSG_LINE_DELETE, args[0] é a versão sobre a qual a
+ * operação foi pedida, args[1] a etapa (STRUCTURE_*) e args[2] o solicitante.
+ * Em MSG_EXPORT, args[0] é a etapa (EXPORT_*), args[1] a versão estrutural
+ * em que todos gravam e args[2] o solicitante; em EXPORT_DONE, line_number é
+ * o número de linhas, args[2] o tempo em ms e args[3] o tamanho em KiB.
+ * Em MSG_SYNC_DATA, line_number é o tamanho total do snapshot e o payload
+ * são os bytes do pedaço args[0].
+ * Em MSG_MERKLE, args[1] é a versão estrutural, args[2] o número de linhas
+ * e args[3] a rodada; o rank 0 só compara se os dois primeiros baterem.
+ * MSG_LINE_DELTA tem os args de MSG_LINE_UPDATE e, em args[3], o checksum do
+ * texto base; a linha é base[0, args[4]) + content + os últimos args[5] bytes
+ * da base. MSG_LINE_COMMIT leva em args[1..3] o mesmo delta (args[2] = -1:
+ * content é a linha inteira). Em MSG_LINE_REFETCH, args[0] é a versão estrutural
+ * e args[1] o número do pedido; MSG_LINE_REFETCH_REPLY tem os args de
+ * MSG_LINE_UPDATE e ecoa o pedido em args[3].
+ */
+
+// Bloqueios por faixa
+#define LOCK_HOME_BLOCK 256           // linhas consecutivas com o mesmo home
+#define LOCK_RING_RESERVE 32          // slots do anel reservados por pedido de bloqueio
+#define LOCK_WAIT_TIMEOUT_S 30        // espera máxima na fila (--lock-timeout, 0 = sem limite)
+#define LOCK_LEASE_MS 15000           // validade de uma concessão sem renovação
+#define LOCK_HEARTBEAT_MS 5000        // intervalo de renovação pelo dono
+#define LOCK_SWEEP_MS 1000            // intervalo da varredura de concessões vencidas no home
+#define LOCK_WRITTEN_KEEP_MS 15000    // por quanto a última escrita de uma linha liberada ainda barra as antigas
+
+// Edição por CRDT
+#define CRDT_GC_MS 2000               // intervalo entre anúncios de estabilidade e limpeza de lápides
+#define CRDT_ROOT -1                  // referência "início da linha" em MSG_CRDT_INSERT
+
+// Modos de edição (--optimistic, --crdt; padrão: bloqueio)
+#define EDIT_MODE_LOCK 0              // uma faixa bloqueada por escritor
+#define EDIT_MODE_OPTIMISTIC 1        // sem bloqueio, commit conferido pela versão no home
+#define EDIT_MODE_CRDT 2              // sem bloqueio, operações por caractere (RGA)
+
+// Backends de bloqueio (selecionados com --lock-backend=msg|rma)
+#define LOCK_BACKEND_MSG 0            // home arbitra por mensagens
+#define LOCK_BACKEND_RMA 1            // janela MPI-3 + MPI_Compare_and_swap
+
+#define MSG_MAX_ARGS 6                // inteiros extras por mensagem (ver message_arg_count)
+
 
+/*
+ * Documento: as linhas ficam numa treap implícita (ordenada pela posição),
+ * com o tamanho da subárvore em cada nó. Achar, substituir, inserir ou
+ * remover a linha i custa O(log n) e não depende do GtkTextBuffer, que é
+ * só uma projeção do documento atualizada linha a linha.
+ */
+typedef struct DocNode {
+    struct DocNode *left;
+    struct DocNode *right;
+    guint32 priority;
+    int size;                         // linhas nesta subárvore
+    char *text;                       // conteúdo da linha, sem o prefixo "NNNN| "
+} DocNode;
+
+/*
+ * Árvore de hashes sobre a posição das linhas: cada folha resume um bloco
+ * de MERKLE_BLOCK_LINES linhas e cada nó interno, seus dois filhos. As
+ * mudanças só marcam blocos; merkle_refresh recalcula esses blocos e o
+ * caminho até a raiz. Réplicas iguais têm a mesma raiz, independentemente
+ * do formato da treap de cada uma.
+ */
+typedef struct {
+    guint64 *nodes;                   // nodes[1] = raiz; folhas em [leaves, 2 * leaves)
+    guint8 *dirty;                    // por folha: bloco mudou desde o último merkle_refresh
+    int leaves;                       // potência de 2 >= número de blocos
+    int shift_from;                   // primeiro bloco deslocado por inserção ou remoção (-1 = nenhum)
+} MerkleTree;
+
+typedef struct {
+    DocNode *root;
+    MerkleTree merkle;                // hashes das linhas (anti-entropia)
+} Document;
+
+/*
+ * Diário do documento (--journal=DIR, só no rank 0). Cada mudança
+ * confirmada vira um registro em pending; a thread do diário grava de uma
+ * vez tudo o que se acumulou e faz um único fsync pelo grupo, então o
+ * commit nunca espera o disco. De tempos em tempos a interface copia o
+ * documento para um snapshot e o diário recomeça depois dele.
+ */
+typedef struct {
+    const char *dir;
+    int fd;                           // DIR/journal (registros depois do snapshot)
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    GString *pending;                 // registros ainda não gravados, em ordem
+    gint64 seq;                       // último número de sequência atribuído
+    gint64 durable;                   // último registro já em disco
+    int since_snapshot;               // registros desde o último snapshot
+    GString *snapshot;                // texto do próximo snapshot (ou NULL)
+    gint64 snapshot_seq;              // último registro incluído nesse snapshot
+    int groups;                       // grupos gravados (um fsync cada)
+    int error;                        // errno da última falha de gravação (0 = nenhuma)
+    int stop;
+    Document recovered;               // ao iniciar: documento reconstruído
+    int replayed;                     // registros reaplicados ao iniciar (-1 = sem snapshot)
+} Journal;
 
 typedef struct {
-    int locked_by;                    // -1 = livre, >= 0 = rank do usuário
-    char owner_name[MAX_USERNAME];
+    int locked_by;                    // -1 = livre, >= 0 = rank do usuário (nome em user_names)
+    int token;                        // token da concessão atual (ou da última)
+    int fence;                        // maior token recolhido por expiração
+    int written;                      // token da última escrita aplicada na concessão atual
+    int version;                      // modo otimista: última versão aceita pelo home
+    int epoch;                        // modo CRDT: substituições inteiras da linha já aplicadas
 } LineInfo;
 
+/*
+ * Elemento de uma linha no modo CRDT (RGA). O id (counter, rank) é um
+ * carimbo de Lamport único; o texto base da linha usa counter 0 e rank
+ * negativo. Elementos removidos viram lápides até que todos os ranks tenham
+ * visto a remoção (ver crdt_purge).
+ */
+typedef struct {
+    int counter;
+    int rank;
+    gunichar ch;
+    int del_counter;                  // 0 = visível; senão carimbo da remoção
+    int del_rank;
+} CrdtElem;
+
+typedef struct {
+    CrdtElem *elems;                  // ordem do documento, incluindo lápides
+    int len;
+    int cap;
+} CrdtLine;
+
+typedef struct {
+    int line;                         // posição inserida ou removida
+    int delta;                        // +1 inserção, -1 remoção
+} StructureOp;
+
 typedef struct {
     GtkWidget *window;
     GtkWidget *text_view;
-    GtkTextBuffer *text_buffer;
+    GtkTextBuffer *text_buffer;       // projeção de doc
     GtkWidget *status_label;
     GtkWidget *line_spin;
+    GtkWidget *range_spin;            // última linha da faixa (inclusiva)
     GtkWidget *edit_button;
     GtkWidget *commit_button;
+    GtkWidget *cancel_button;         // desiste de um pedido na fila
     GtkWidget *log_view;
     GtkTextBuffer *log_buffer;
     GtkWidget *chat_view;
@@ -44,11 +321,77 @@ typedef struct {
     GtkWidget *chat_entry;
     
     gboolean p_update;                // Flag para updates programáticos
+    gboolean batching;                // Aplicando um lote: adia rolagem e status
+    gboolean log_dirty;
+    gboolean chat_dirty;
+    gboolean status_dirty;
     char username[MAX_USERNAME];
+    char (*user_names)[MAX_USERNAME]; // nome de cada rank, trocado uma vez ao iniciar
     int rank;
     int size;
-    int editing_line;                 // -1 = não editando, >= 0 = linha sendo editada
-    LineInfo lines[MAX_LINES];
+    int lock_backend;                 // LOCK_BACKEND_MSG ou LOCK_BACKEND_RMA
+    int lock_timeout_s;               // espera máxima por um bloqueio (0 = sem limite)
+    int edit_mode;                    // EDIT_MODE_LOCK, EDIT_MODE_OPTIMISTIC ou EDIT_MODE_CRDT
+    gboolean headless;                // sem GTK: só o documento em memória e uma carga
+    const char *script_path;          // roteiro da carga sem interface (NULL = aleatória)
+    int workload_ops;                 // edições da carga aleatória
+    int think_ms;                     // pausa entre ações da carga
+    unsigned int seed;                // semente da carga aleatória (somada ao rank)
+    gboolean bench;                   // executa o benchmark do protocolo (implica headless)
+    int bench_iters;
+    int bench_format;                 // BENCH_FORMAT_CSV ou BENCH_FORMAT_JSON
+    gboolean generating;              // geração em andamento
+    int generated;                    // linhas enviadas pela geração desde o início
+    MPI_Win lock_win;                 // tabela de donos exposta via RMA (backend RMA)
+    int *lock_win_base;
+    int editing_line;                 // -1 = não editando, >= 0 = primeira linha editada
+    int editing_end;                  // fim (exclusivo) da faixa sendo editada
+    int waiting_line;                 // -1 = sem pedido pendente, >= 0 = faixa pedida
+    int waiting_end;
+    int queue_position;               // posição na fila do home (0 = ainda sem resposta)
+    int *edit_base;                   // modo otimista: versão de cada linha ao começar a editar
+    char **edit_stash;                // modo otimista: escrita remota recebida durante a edição
+    char **edit_text;                 // texto de cada linha ao começar a editar (base dos deltas)
+    GHashTable *crdt_lines;           // modo CRDT: linha -> CrdtLine*, criado no primeiro uso
+    int crdt_clock;                   // relógio de Lamport deste rank
+    int *crdt_seen;                   // maior carimbo integrado de cada rank
+    int *crdt_reports;                // crdt_seen anunciado por cada rank (size x size)
+    int crdt_seen_dirty;
+    GQueue crdt_pending;              // Message* à espera de dependência
+    Document doc;                     // conteúdo autoritativo das linhas
+    int initial_lines;                // linhas do documento ao iniciar (--lines ou o arquivo)
+    const char *open_path;            // arquivo de --open (lido só no rank 0)
+    const char *save_path;            // destino de "Salvar" (--save, senão o de --open)
+    gint64 loaded_bytes;              // tamanho do arquivo difundido pelo rank 0 (-1 = nenhum)
+    int truncated_lines;              // linhas do arquivo cortadas em MAX_LINE_LENGTH
+    const char *journal_dir;          // --journal: diretório do diário (usado no rank 0)
+    Journal *journal;                 // diário ativo (NULL fora do rank 0 ou sem --journal)
+    GHashTable *line_state;           // linha -> LineInfo*, só das linhas fora do estado livre
+    GHashTable *refetches;            // linha -> pedido MSG_LINE_REFETCH ainda sem resposta
+    int refetch_next;                 // número do próximo pedido
+    GHashTable *released_writes;      // linha -> token da última escrita, liberadas neste período
+    GHashTable *released_before;      // o mesmo, do período anterior
+    int structure;                    // versão estrutural: inserções e remoções aplicadas
+    StructureOp structure_log[STRUCTURE_HISTORY]; // operação que levou a versão v a v + 1
+    GQueue structure_pending;         // UiSlot* numerados numa versão que ainda não chegou
+    int structure_op;                 // MSG_LINE_INSERT/DELETE pedida aqui (0 = nenhuma)
+    int structure_line;               // posição da operação pedida
+    int exports;                      // exportações MPI-IO pedidas ou em andamento neste rank
+    int merkle_ms;                    // intervalo da anti-entropia (0 = desligada)
+    int fanout;                       // FANOUT_*
+    MPI_Comm lane_comm[COMM_LANES];   // um MPI_Comm_dup por canal
+    int merkle_rounds;                // rodadas de comparação iniciadas
+    gboolean merkle_active;           // rodada merkle_rounds em andamento
+    int merkle_outstanding;           // mensagens da rodada ainda sem resposta
+    int merkle_repaired;              // linhas reparadas na rodada
+    GHashTable *merkle_suspects;      // bloco -> hashes (local, rank 0) divergentes na rodada anterior
+    GHashTable *merkle_seen;          // bloco -> hashes divergentes na rodada atual
+    gboolean syncing;                 // esperando o snapshot pedido com MSG_SYNC_REQUEST
+    char *sync_data;                  // snapshot sendo recebido (NULL antes do primeiro pedaço)
+    int sync_len;                     // tamanho total do snapshot
+    int sync_received;                // bytes já recebidos
+    gint64 sync_started;
+    GQueue sync_pending;              // UiSlot* que chegaram durante a transferência
     char line_backup[MAX_LINE_LENGTH]; // backup da linha antes de editar
 } EditorData;
 
@@ -57,46 +400,670 @@ typedef struct {
     int line_number;
     char content[MAX_LINE_LENGTH];
     int sender_rank;
-    char sender_name[MAX_USERNAME];
+    int args[MSG_MAX_ARGS];
 } Message;
 
 typedef struct {
-    EditorData *editor;
+    int start;
+    int end;                          // exclusivo
+    int owner;
+    int token;                        // token de cerca, crescente por home
+    gint64 expires;                   // fim da concessão (tempo monotônico)
+} HeldRange;
+
+typedef struct {
+    int start;
+    int end;
+    int requester;
+    int id;                           // identificador do pedido no solicitante
+    int position;                     // última posição informada ao solicitante
+} LockWaiter;
+
+/*
+ * Estado de bloqueios mantido pela thread do motor.
+ * Cada bloco de LOCK_HOME_BLOCK linhas tem um rank home (lock_home) que é o
+ * único a decidir quem bloqueia suas linhas. O home guarda as faixas
+ * concedidas ordenadas e disjuntas, e responde "há linha bloqueada em
+ * [a, b)?" com busca binária. Pedidos em conflito esperam em uma fila FIFO
+ * e são concedidos pelo próprio home quando a faixa é liberada.
+ * Cada concessão é um lease: vence se o dono não a renovar com
+ * MSG_LOCK_HEARTBEAT, e o home a recolhe na varredura periódica.
+ * O motor também coordena o pedido de faixa da interface local, segmento por
+ * segmento e em ordem crescente de linha.
+ */
+typedef struct {
+    HeldRange *held;
+    int nheld;
+    int cap;
+    GQueue waiters;                   // LockWaiter*, em ordem de chegada
+    int next_token;
+    gint64 next_sweep;
+    GHashTable *versions;             // modo otimista: linha -> versão, só as já escritas
+    int lines;                        // tamanho do documento na numeração do motor
+    int structure;                    // versão estrutural aplicada pelo motor
+    int acquiring;                    // pedido de faixa local em andamento
+    int acq_id;
+    int acq_start;
+    int acq_end;
+    int acq_next;                     // início do próximo segmento a pedir
+    int acq_structure;                // versão estrutural da numeração do pedido
+    gint64 acq_deadline;              // tempo monotônico limite, 0 = sem limite
+} LockManager;
+
+/*
+ * Cabeçalho fixo de toda mensagem no fio (16 bytes), seguido de `length`
+ * bytes de payload: os args do tipo (message_arg_count) e depois o content,
+ * se houver. O nome do remetente não trafega: é obtido pelo rank.
+ * Em MSG_LINE_UPDATE_BATCH, line_number é o número de registros e, depois
+ * do token e da versão estrutural, o payload são registros (int line,
+ * int length, bytes[length]) sem alinhamento. length < 0 marca um registro
+ * delta: checksum da base, prefixo e sufixo, e então -1 - length bytes.
+ */
+typedef struct {
+    int32_t type;
+    int32_t line_number;
+    int32_t sender_rank;
+    int32_t length;
+} WireHeader;
+
+#define BATCH_RECORDS_OFFSET (sizeof(WireHeader) + 2 * sizeof(int))  // cabeçalho + token + versão
+#define DELTA_OVERHEAD (3 * (int)sizeof(int))  // checksum da base, prefixo e sufixo de um delta
+
+typedef struct {
     Message msg;
-} UpdateData;
+    char *payload;                    // registros de MSG_LINE_UPDATE_BATCH (ou NULL)
+    int payload_len;
+} UiSlot;
+
+/*
+ * Anel SPSC de mensagens recebidas: o motor preenche slots pré-alocados e a
+ * thread da interface drena tudo de uma vez a cada quadro.
+ */
+typedef struct {
+    UiSlot slots[UI_RING_SIZE];
+    atomic_uint head;                 // próximo slot a ler (consumidor)
+    atomic_uint tail;                 // próximo slot a escrever (produtor)
+    atomic_int drain_scheduled;
+} UpdateRing;
+
+/*
+ * Faixa do documento que este rank grava numa exportação MPI-IO: preparada
+ * pela interface (dona do documento) e gravada pelo motor (dono do MPI)
+ */
+typedef struct {
+    char path[MAX_LINE_LENGTH];
+    int lines;                        // linhas do documento inteiro
+    char *data;                       // linhas [count * rank / size, count * (rank + 1) / size), com '\n'
+    long long len;
+} ExportJob;
 
 typedef struct {
     int line_number;
     char content[MAX_LINE_LENGTH];
 } OMPLineData;
 
+typedef struct {
+    EditorData *editor;
+    GtkWidget *button;
+    OMPLineData *data;
+    int count;                        // linhas geradas
+    int next;                         // próxima linha a enviar
+    int structure;                    // versão estrutural da numeração gerada
+} GenerationJob;
+
+typedef struct {
+    EditorData *editor;
+    GMainLoop *loop;
+    char **script;                    // linhas do roteiro (NULL = carga aleatória)
+    int next;                         // próxima linha do roteiro
+    int ops_left;                     // pedidos restantes da carga aleatória
+    int done;                         // edições confirmadas
+    gint64 resume_at;                 // fim de um "sleep" do roteiro (tempo monotônico)
+    int checks;                       // conferências "expect" do roteiro
+    int failures;                     // conferências que não bateram
+    gboolean finished;
+} HeadlessJob;
+
+typedef struct {
+    int kind;                         // BENCH_*
+    int size;                         // bytes por mensagem (0 = não se aplica)
+} BenchStep;
+
+typedef struct {
+    int samples;
+    int p50_us;
+    int p90_us;
+    int p99_us;
+    int max_us;
+    double total_ms;
+    double ops_per_s;
+} BenchResult;
+
+/*
+ * Estado do benchmark em um rank. O rank 0 conduz os passos de bench_plan:
+ * anuncia cada um, espera o relatório de todos e só então passa ao próximo.
+ * As mensagens são contadas cumulativamente (não por passo), porque a de
+ * um rank pode chegar antes do anúncio do passo vindo do rank 0.
+ * Tempos em µs do relógio monotônico local; latências entre ranks são
+ * sempre medidas como ida e volta no mesmo rank.
+ */
+typedef struct {
+    EditorData *editor;
+    GMainLoop *loop;
+    int step;                         // passo em execução (-1 = nenhum)
+    int next_step;                    // passo anunciado e ainda não iniciado (-1 = nenhum)
+    int reported;                     // este rank já relatou o passo
+    int iter;                         // medidas concluídas no passo
+    int sent;                         // mensagens de chat enviadas no passo
+    int outcome;                      // pedido de bloqueio: 0 = esperando, 1 = concedido, -1 = negado
+    int echoes;                       // rank 0: ecos da atualização corrente
+    gint64 started;                   // início da medida corrente
+    gint64 event_at;                  // concessão ou último eco da medida corrente (0 = ainda não)
+    int updates;                      // atualizações de medida recebidas (cumulativo)
+    int chats;                        // mensagens de chat recebidas (cumulativo)
+    int records;                      // linhas recebidas em lotes (cumulativo)
+    int expect_updates;
+    int expect_chats;
+    int expect_records;               // -1 = o rank 0 ainda não informou
+    int *samples;                     // latências deste rank no passo, em µs
+    int nsamples;
+    int cap;
+    int reports;                      // rank 0: ranks que já relataram o passo
+    gint64 step_started;              // rank 0: anúncio do passo
+    int *merged;                      // rank 0: latências de todos os ranks no passo
+    int nmerged;
+    int merged_cap;
+    BenchResult *results;             // rank 0: um por passo
+    gboolean finished;
+} BenchRun;
+
+typedef struct OutboundMsg {
+    _Atomic(struct OutboundMsg *) next;
+    int dest;                         // rank destino ou COMM_BROADCAST
+    int refs;                         // filas por destino que ainda usam os bytes
+    int tag;                          // tag MPI: 0, ou FANOUT_TAG_BASE + raiz da árvore
+    int lane;                         // LANE_*
+    unsigned int barrier;             // para o próprio rank: dados enfileirados antes dela
+    int len;
+    char *data;                       // bytes no fio (alocados logo após a estrutura)
+} OutboundMsg;
+
+/*
+ * Fila MPSC intrusiva (Vyukov): a interface (e qualquer outra thread) empurra
+ * mensagens sem bloquear; somente o motor de comunicação consome.
+ */
+typedef struct {
+    _Atomic(OutboundMsg *) head;
+    OutboundMsg *tail;
+    OutboundMsg stub;
+} OutboundQueue;
+
+/*
+ * Estruturas de envio do motor (acessadas apenas pela thread do motor).
+ * Um broadcast compartilha a mesma OutboundMsg entre as filas de destino.
+ */
+typedef struct PendingSend {
+    struct PendingSend *next;
+    OutboundMsg *out;
+    unsigned int seq;                 // LANE_DATA: ordem de enfileiramento no pool
+} PendingSend;
+
+typedef struct {
+    PendingSend *head[COMM_LANES];    // uma fila por canal: o controle sai primeiro
+    PendingSend *tail[COMM_LANES];
+    int inflight;
+} DestQueue;
+
+typedef struct {
+    MPI_Request req[COMM_MAX_INFLIGHT];
+    OutboundMsg *out[COMM_MAX_INFLIGHT];
+    int dest[COMM_MAX_INFLIGHT];
+    int free_slots[COMM_MAX_INFLIGHT];
+    int nfree;
+    DestQueue *dests;                 // uma fila por rank
+    int next_dest;                    // round-robin entre destinos
+    int queued;                       // itens nas filas por destino
+    unsigned int data_seq;            // próximo seq de LANE_DATA
+} SendPool;
+
+/*
+ * Recepção de um canal no motor: COMM_RECV_SLOTS MPI_Irecv postados no
+ * comunicador do canal e os quadros recebidos que esperam espaço no anel.
+ */
+typedef struct {
+    char *buf[COMM_RECV_SLOTS];
+    int len[COMM_RECV_SLOTS];
+    MPI_Request req[COMM_RECV_SLOTS];
+    int parked[COMM_RECV_SLOTS];      // recebidas mas ainda não entregues, em ordem
+    int nparked;
+    unsigned int posted[COMM_RECV_SLOTS]; // ordem em que cada MPI_Irecv foi postado
+    unsigned int next_post;
+    MPI_Comm comm;
+} RecvLane;
+
+/*
+ * Métricas de um canal, escritas pelo motor e lidas pela interface
+ */
+typedef struct {
+    atomic_int sent;                  // quadros postados com MPI_Isend
+    atomic_int received;
+    atomic_int queued;                // esperando slot no pool de envio
+    atomic_int queued_peak;
+    atomic_int parked;                // recebidos esperando espaço no anel
+    atomic_int parked_peak;
+} LaneStats;
+
 EditorData *g_editor = NULL;
 pthread_mutex_t update_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_t receiver_thread;
-int running = 1;
+pthread_t engine_thread;
+atomic_int running = 1;
+
+OutboundQueue outbound_queue;
+pthread_mutex_t engine_wake_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t engine_wake_cond = PTHREAD_COND_INITIALIZER;
+atomic_int engine_idle = 0;
+atomic_int comm_pending = 0;          // mensagens enfileiradas e ainda não completadas
+atomic_int fanout_left = 0;           // ranks que já saíram, inclusive este
+LaneStats lane_stats[COMM_LANES];
+const char *lane_names[] = {"controle", "dados", "chat"};
+
+pthread_mutex_t export_mutex = PTHREAD_MUTEX_INITIALIZER;
+GQueue export_jobs = G_QUEUE_INIT;    // ExportJob* prontos para o motor, em ordem
+atomic_int export_queued = 0;
+
+UpdateRing update_ring;
 
 const char *word_bank[] = {
     "thread", "deadlock", "race", "speedup", "pragma", "private", "shared", "reduction", "critical", "atomic", "barrier", "schedule", "dynamic", "static", "chunk", "nowait", "master", "single", "sections", "rank", "size", "send", "recv", "broadcast"
 };
 const int word_bank_size = 24;
 
+const BenchStep bench_plan[] = {
+    {BENCH_LOCK_FREE, 0}, {BENCH_LOCK_CONTENDED, 0},
+    {BENCH_UPDATE, 16}, {BENCH_UPDATE, 64}, {BENCH_UPDATE, 128}, {BENCH_UPDATE, 240},
+    {BENCH_CHAT, 16}, {BENCH_CHAT, 64}, {BENCH_CHAT, 128}, {BENCH_CHAT, 240},
+    {BENCH_GENERATION, 0}
+};
+const int bench_plan_size = sizeof(bench_plan) / sizeof(bench_plan[0]);
+const char *bench_names[] = {
+    "lock_uncontended", "lock_contended", "update_rtt", "chat_fanout", "generation"
+};
+
+BenchRun *g_bench = NULL;             // benchmark em andamento (só com --bench)
+
+/**
+ * Inicializa a fila de saída vazia (apenas o nó sentinela)
+ */
+void outbound_init(OutboundQueue *q) {
+    atomic_store(&q->stub.next, NULL);
+    atomic_store(&q->head, &q->stub);
+    q->tail = &q->stub;
+}
+
+/**
+ * Empurra uma mensagem na fila (seguro para múltiplos produtores, sem locks)
+ */
+void outbound_push(OutboundQueue *q, OutboundMsg *node) {
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    OutboundMsg *prev = atomic_exchange_explicit(&q->head, node, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, node, memory_order_release);
+}
+
+/**
+ * Retira a próxima mensagem (somente a thread do motor chama)
+ * Retorna NULL se a fila está vazia ou um produtor ainda está no meio do push.
+ */
+OutboundMsg *outbound_pop(OutboundQueue *q) {
+    OutboundMsg *tail = q->tail;
+    OutboundMsg *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+    if (tail == &q->stub) {
+        if (next == NULL) return NULL;
+        q->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    }
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+    if (tail != atomic_load_explicit(&q->head, memory_order_acquire)) return NULL;
+
+    outbound_push(q, &q->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+/**
+ * Verifica se a fila de saída está vazia (visão do consumidor)
+ */
+int outbound_empty(OutboundQueue *q) {
+    return q->tail == &q->stub &&
+           atomic_load_explicit(&q->stub.next, memory_order_acquire) == NULL &&
+           atomic_load_explicit(&q->head, memory_order_acquire) == &q->stub;
+}
+
+/**
+ * Acorda o motor de comunicação se ele estiver dormindo
+ */
+void engine_wake(void) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&engine_idle)) {
+        pthread_mutex_lock(&engine_wake_mutex);
+        pthread_cond_signal(&engine_wake_cond);
+        pthread_mutex_unlock(&engine_wake_mutex);
+    }
+}
+
+/**
+ * Canal de um tipo de mensagem
+ * Tudo que decide quem escreve vai pelo controle, que nunca espera atrás
+ * de lotes de dados; conteúdo e chat têm canais próprios.
+ */
+int message_lane(int type) {
+    switch (type) {
+        case MSG_LINE_UPDATE:
+        case MSG_LINE_UPDATE_BATCH:
+        case MSG_LINE_SUBMIT_BATCH:
+        case MSG_LINE_COMMIT:
+        case MSG_LINE_CONFLICT:
+        case MSG_LINE_DELTA:
+        case MSG_LINE_REFETCH:
+        case MSG_LINE_REFETCH_REPLY:
+        case MSG_CRDT_INSERT:
+        case MSG_CRDT_DELETE:
+        case MSG_CRDT_ACK:
+        case MSG_BENCH_REPORT:
+        case MSG_SYNC_DATA:
+        case MSG_MERKLE:
+            return LANE_DATA;
+        case MSG_CHAT:
+        case MSG_LOG_ENTRY:
+            return LANE_CHAT;
+        default:
+            return LANE_CONTROL;
+    }
+}
+
+/**
+ * Eleva peak até value, se for menor
+ */
+void stat_peak(atomic_int *peak, int value) {
+    int current = atomic_load_explicit(peak, memory_order_relaxed);
+    while (value > current && !atomic_compare_exchange_weak(peak, &current, value)) {
+    }
+}
+
+/**
+ * Enfileira um quadro (cabeçalho + payload) para um rank (ou COMM_BROADCAST)
+ * sem chamar MPI
+ * Nunca bloqueia; retorna COMM_BACKPRESSURE quando há mensagens demais
+ * pendentes, para que o chamador possa reduzir o ritmo.
+ */
+int comm_send_frame(int dest, const WireHeader *header, const void *payload) {
+    int copies = 1;
+    if (dest == COMM_BROADCAST) {
+        copies = g_editor->size - 1;
+        if (copies <= 0) return COMM_OK;
+    } else if (dest == g_editor->rank) {
+        copies = 0;                   // entregue pelo próprio motor, sem MPI
+    }
+
+    int len = sizeof(WireHeader) + header->length;
+    OutboundMsg *node = g_malloc(sizeof(OutboundMsg) + len);
+    node->dest = dest;
+    node->refs = 0;
+    node->tag = 0;
+    node->lane = message_lane(header->type);
+    node->barrier = 0;
+    node->len = len;
+    node->data = (char *)(node + 1);
+    memcpy(node->data, header, sizeof(WireHeader));
+    if (header->length > 0) {
+        memcpy(node->data + sizeof(WireHeader), payload, header->length);
+    }
+    int pending = atomic_fetch_add(&comm_pending, copies) + copies;
+    outbound_push(&outbound_queue, node);
+    engine_wake();
+
+    return pending > COMM_HIGH_WATERMARK ? COMM_BACKPRESSURE : COMM_OK;
+}
+
+/**
+ * Indica se um tipo de mensagem carrega o campo content no fio
+ */
+int message_has_content(int type) {
+    return type == MSG_LINE_UPDATE || type == MSG_CHAT || type == MSG_LOG_ENTRY ||
+           type == MSG_LINE_COMMIT || type == MSG_LINE_CONFLICT || type == MSG_CRDT_INSERT ||
+           type == MSG_LINE_INSERT || type == MSG_EXPORT || type == MSG_LINE_DELTA ||
+           type == MSG_LINE_REFETCH_REPLY;
+}
+
+/**
+ * Número de inteiros extras que um tipo de mensagem carrega no fio
+ */
+int message_arg_count(int type) {
+    switch (type) {
+        case MSG_LINE_UNLOCK:
+        case MSG_RANGE_UNLOCK:
+        case MSG_LOCK_HEARTBEAT:
+        case MSG_BENCH_REPORT:
+            return 1;
+        case MSG_LINE_REFETCH:
+        case MSG_LINE_CONFLICT:
+        case MSG_LINE_UPDATE_BATCH:
+        case MSG_LINE_SUBMIT_BATCH:
+        case MSG_SYNC_DATA:
+        case MSG_RANGE_LOCK:
+        case MSG_LINE_LOCK_DENIED:
+        case MSG_LINE_LOCK_CANCEL:
+        case MSG_RANGE_CANCEL:
+            return 2;
+        case MSG_LINE_LOCK_REQUEST:
+        case MSG_LINE_LOCK_QUEUED:
+        case MSG_LINE_UPDATE:
+        case MSG_LINE_INSERT:
+        case MSG_LINE_DELETE:
+            return 3;
+        case MSG_LINE_COMMIT:
+        case MSG_LINE_LOCK_GRANTED:
+        case MSG_LINE_REFETCH_REPLY:
+        case MSG_CRDT_INSERT:
+        case MSG_CRDT_DELETE:
+        case MSG_BENCH:
+        case MSG_EXPORT:
+        case MSG_MERKLE:
+            return 4;
+        case MSG_LINE_LOCK_OWNER:
+            return 5;
+        case MSG_LINE_DELTA:
+            return 6;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Enfileira uma Message para um rank (ou COMM_BROADCAST)
+ * Mensagens de bloqueio vão só com o cabeçalho de 16 bytes.
+ */
+int comm_send(int dest, const Message *msg) {
+    char payload[MSG_MAX_ARGS * sizeof(int) + MAX_LINE_LENGTH];
+    int nargs = message_arg_count(msg->type);
+    int length = nargs * sizeof(int);
+
+    memcpy(payload, msg->args, length);
+    if (message_has_content(msg->type)) {
+        int n = strnlen(msg->content, MAX_LINE_LENGTH - 1);
+        memcpy(payload + length, msg->content, n);
+        length += n;
+    }
+
+    WireHeader header;
+    header.type = msg->type;
+    header.line_number = msg->line_number;
+    header.sender_rank = msg->sender_rank;
+    header.length = length;
+    return comm_send_frame(dest, &header, payload);
+}
+
+/**
+ * Decodifica um quadro do fio em uma Message
+ * Para MSG_LINE_UPDATE_BATCH, records e records_len indicam os registros
+ * dentro de data. Retorna 0 se o quadro está malformado.
+ */
+int wire_decode(const char *data, int len, Message *msg, const char **records, int *records_len) {
+    WireHeader header;
+
+    if (len < (int)sizeof(WireHeader)) return 0;
+    memcpy(&header, data, sizeof(WireHeader));
+    if (header.length < 0 || len != (int)sizeof(WireHeader) + header.length) return 0;
+
+    const char *payload = data + sizeof(WireHeader);
+    int nargs = message_arg_count(header.type);
+    if (header.length < nargs * (int)sizeof(int)) return 0;
+
+    msg->type = header.type;
+    msg->line_number = header.line_number;
+    msg->sender_rank = header.sender_rank;
+    memcpy(msg->args, payload, nargs * sizeof(int));
+    payload += nargs * sizeof(int);
+
+    int n = header.length - nargs * sizeof(int);
+    *records = NULL;
+    *records_len = 0;
+    if (header.type == MSG_LINE_UPDATE_BATCH || header.type == MSG_LINE_SUBMIT_BATCH ||
+        header.type == MSG_CRDT_ACK || header.type == MSG_BENCH_REPORT || header.type == MSG_SYNC_DATA ||
+        header.type == MSG_MERKLE) {
+        *records = payload;
+        *records_len = n;
+        n = 0;
+    }
+    if (n > MAX_LINE_LENGTH - 1) n = MAX_LINE_LENGTH - 1;
+    memcpy(msg->content, payload, n);
+    msg->content[n] = '\0';
+    return 1;
+}
+
+/**
+ * Rank home de uma linha: o único que arbitra seu bloqueio
+ * Blocos de LOCK_HOME_BLOCK linhas são distribuídos em round-robin.
+ */
+int lock_home(EditorData *editor, int line) {
+    return (line / LOCK_HOME_BLOCK) % editor->size;
+}
+
+/**
+ * Fim (exclusivo) do segmento de [line, end) que tem o mesmo home de line
+ */
+int lock_segment_end(int line, int end) {
+    int block_end = (line / LOCK_HOME_BLOCK + 1) * LOCK_HOME_BLOCK;
+    return end < block_end ? end : block_end;
+}
+
+/**
+ * Posição da linha na janela RMA do seu home
+ */
+MPI_Aint lock_slot(EditorData *editor, int line) {
+    int block = line / LOCK_HOME_BLOCK;
+    return (MPI_Aint)(block / editor->size) * LOCK_HOME_BLOCK + line % LOCK_HOME_BLOCK;
+}
+
+/**
+ * Cria a janela RMA com os donos das linhas deste home (chamada coletiva)
+ */
+void rma_locks_init(EditorData *editor) {
+    // Sem inserção nem remoção de linhas nesse backend: o tamanho não muda
+    int blocks = (editor->initial_lines + LOCK_HOME_BLOCK - 1) / LOCK_HOME_BLOCK;
+    int slots = ((blocks + editor->size - 1) / editor->size) * LOCK_HOME_BLOCK;
+
+    MPI_Win_allocate(slots * sizeof(int), sizeof(int), MPI_INFO_NULL, MPI_COMM_WORLD,
+                     &editor->lock_win_base, &editor->lock_win);
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, editor->rank, 0, editor->lock_win);
+    for (int i = 0; i < slots; i++) editor->lock_win_base[i] = -1;
+    MPI_Win_unlock(editor->rank, editor->lock_win);
+    MPI_Barrier(MPI_COMM_WORLD);
+}
+
+/**
+ * Enfileira uma mensagem para todos os outros processos
+ */
+int comm_broadcast(const Message *msg) {
+    return comm_send(COMM_BROADCAST, msg);
+}
+
+/**
+ * Nome do usuário de um rank
+ */
+const char *user_name(EditorData *editor, int rank) {
+    if (rank < 0 || rank >= editor->size) return "?";
+    return editor->user_names[rank];
+}
+
+/**
+ * Monta a tabela rank -> nome com o nome de cada usuário (chamada coletiva)
+ * Trocada uma única vez, antes do motor: daí em diante os nomes viajam e
+ * ficam guardados só como rank.
+ */
+void init_user_names(EditorData *editor) {
+    editor->user_names = g_malloc(editor->size * MAX_USERNAME);
+    MPI_Allgather(editor->username, MAX_USERNAME, MPI_CHAR, editor->user_names, MAX_USERNAME,
+                  MPI_CHAR, MPI_COMM_WORLD);
+}
+
+/**
+ * Acrescenta um registro (linha, tamanho, bytes) a um lote
+ * Retorna o novo tamanho usado ou -1 se o registro não cabe.
+ */
+int batch_append(char *buf, int used, int line, const char *text) {
+    int length = strlen(text);
+    if (used + 2 * (int)sizeof(int) + length > COMM_BATCH_MAX_BYTES) return -1;
+
+    memcpy(buf + used, &line, sizeof(int));
+    memcpy(buf + used + sizeof(int), &length, sizeof(int));
+    memcpy(buf + used + 2 * sizeof(int), text, length);
+    return used + 2 * sizeof(int) + length;
+}
+
+/**
+ * Indica se a rede está congestionada (pendências acima do limite)
+ */
+int comm_backpressure(void) {
+    return atomic_load(&comm_pending) > COMM_HIGH_WATERMARK;
+}
+
 /**
  * Adiciona uma entrada no log com timestamp
  */
 void append_log(EditorData *editor, const char *message) {
-    GtkTextIter end;
-    gtk_text_buffer_get_end_iter(editor->log_buffer, &end);
-
     time_t now = time(NULL);
     struct tm *tm_info = localtime(&now);
     char timestamp[20];
     strftime(timestamp, 20, "%H:%M:%S", tm_info);
 
+    if (editor->headless) {
+        if (editor->bench) return;    // a saída padrão é só do relatório
+        printf("[%s] %s: %s\n", timestamp, editor->username, message);
+        fflush(stdout);
+        return;
+    }
+
+    GtkTextIter end;
+    gtk_text_buffer_get_end_iter(editor->log_buffer, &end);
+
     char log_entry[512];
     sprintf(log_entry, "[%s] %s\n", timestamp, message);
 
     gtk_text_buffer_insert(editor->log_buffer, &end, log_entry, -1);
 
+    if (editor->batching) {
+        editor->log_dirty = TRUE;
+        return;
+    }
     GtkTextMark *mark = gtk_text_buffer_get_insert(editor->log_buffer);
     gtk_text_view_scroll_mark_onscreen(GTK_TEXT_VIEW(editor->log_view), mark);
 }
@@ -105,6 +1072,13 @@ void append_log(EditorData *editor, const char *message) {
  * Adiciona uma mensagem no chat
  */
 void append_chat(EditorData *editor, const char *sender, const char *message) {
+    if (editor->headless) {
+        if (editor->bench) return;
+        printf("[chat] %s <- %s: %s\n", editor->username, sender, message);
+        fflush(stdout);
+        return;
+    }
+
     GtkTextIter end;
     gtk_text_buffer_get_end_iter(editor->chat_buffer, &end);
 
@@ -113,6 +1087,10 @@ void append_chat(EditorData *editor, const char *sender, const char *message) {
 
     gtk_text_buffer_insert(editor->chat_buffer, &end, chat_entry, -1);
 
+    if (editor->batching) {
+        editor->chat_dirty = TRUE;
+        return;
+    }
     GtkTextMark *mark = gtk_text_buffer_get_insert(editor->chat_buffer);
     gtk_text_view_scroll_mark_onscreen(GTK_TEXT_VIEW(editor->chat_view), mark);
 }
@@ -131,634 +1109,5893 @@ void generate_line_content_omp(char *buffer, int thread_id) {
     }
 }
 
-/**
- * Obtém o conteúdo de uma linha específica (após o identificador)
- */
-char *get_line_content(GtkTextBuffer *buffer, int line_num) {
-    GtkTextIter start, end;
-    gtk_text_buffer_get_iter_at_line(buffer, &start, line_num);
+int doc_size(DocNode *node) {
+    return node ? node->size : 0;
+}
 
-    // Encontra o início do conteúdo (após o '|')
-    while (!gtk_text_iter_ends_line(&start)) {
-        gunichar ch = gtk_text_iter_get_char(&start);
-        if (ch == '|') {
-            gtk_text_iter_forward_char(&start);
-            if (gtk_text_iter_get_char(&start) == ' ') {
-                gtk_text_iter_forward_char(&start);
-            }
-            break;
-        }
-        gtk_text_iter_forward_char(&start);
-    }
+void doc_update(DocNode *node) {
+    node->size = 1 + doc_size(node->left) + doc_size(node->right);
+}
 
-    end = start;
-    if (!gtk_text_iter_ends_line(&end)) {
-        gtk_text_iter_forward_to_line_end(&end);
+/**
+ * Junta duas treaps (todas as linhas de a antes das de b)
+ */
+DocNode *doc_merge(DocNode *a, DocNode *b) {
+    if (a == NULL) return b;
+    if (b == NULL) return a;
+
+    if (a->priority > b->priority) {
+        a->right = doc_merge(a->right, b);
+        doc_update(a);
+        return a;
     }
-    return gtk_text_buffer_get_text(buffer, &start, &end, FALSE);
+    b->left = doc_merge(a, b->left);
+    doc_update(b);
+    return b;
 }
 
 /**
- * Define o conteúdo de uma linha específica
+ * Separa as primeiras count linhas de node em *left e o resto em *right
  */
-void set_line_content(GtkTextBuffer *buffer, int line_num, const char *text) {
-    GtkTextIter start, end;
-    gtk_text_buffer_get_iter_at_line(buffer, &start, line_num);
-
-    GtkTextIter content_start = start;
-    // Encontra o início do conteúdo (após o '|')
-    while (!gtk_text_iter_ends_line(&content_start)) {
-        gunichar ch = gtk_text_iter_get_char(&content_start);
-        if (ch == '|') {
-            gtk_text_iter_forward_char(&content_start);
-            if (gtk_text_iter_get_char(&content_start) == ' ') {
-                gtk_text_iter_forward_char(&content_start);
-            }
-            break;
-        }
-        gtk_text_iter_forward_char(&content_start);
+void doc_split(DocNode *node, int count, DocNode **left, DocNode **right) {
+    if (node == NULL) {
+        *left = NULL;
+        *right = NULL;
+        return;
     }
 
-    end = content_start;
-    if (!gtk_text_iter_ends_line(&end)) {
-        gtk_text_iter_forward_to_line_end(&end);
+    if (doc_size(node->left) < count) {
+        doc_split(node->right, count - doc_size(node->left) - 1, &node->right, right);
+        *left = node;
+    } else {
+        doc_split(node->left, count, left, &node->left);
+        *right = node;
     }
+    doc_update(node);
+}
 
-    gtk_text_buffer_delete(buffer, &content_start, &end);
-    gtk_text_buffer_insert(buffer, &content_start, text, -1);
+void doc_free_nodes(DocNode *node) {
+    if (node == NULL) return;
+    doc_free_nodes(node->left);
+    doc_free_nodes(node->right);
+    g_free(node->text);
+    g_free(node);
 }
 
 /**
- * Destaca uma linha com cor baseada no status de bloqueio
+ * Marca o bloco da linha line para recálculo
  */
-void highlight_line(EditorData *editor, int line_num) {
-    GtkTextIter buffer_start, buffer_end;
-    gtk_text_buffer_get_start_iter(editor->text_buffer, &buffer_start);
-    gtk_text_buffer_get_end_iter(editor->text_buffer, &buffer_end);
-    gtk_text_buffer_remove_all_tags(editor->text_buffer, &buffer_start, &buffer_end);
-
-    GtkTextIter start, end;
-    gtk_text_buffer_get_iter_at_line(editor->text_buffer, &start, line_num);
-    end = start;
-    gtk_text_iter_forward_line(&end);
-
-    if (editor->lines[line_num].locked_by == editor->rank) {
-        // Verde para linha editada pelo usuário atual
-        GtkTextTag *tag = gtk_text_buffer_create_tag(editor->text_buffer, NULL,
-                                                    "background", "#90EE90", NULL);
-        gtk_text_buffer_apply_tag(editor->text_buffer, tag, &start, &end);
-    } else if (editor->lines[line_num].locked_by >= 0) {
-        // Rosa para linha editada por outro usuário
-        GtkTextTag *tag = gtk_text_buffer_create_tag(editor->text_buffer, NULL,
-                                                    "background", "#FFB6C1", NULL);
-        gtk_text_buffer_apply_tag(editor->text_buffer, tag, &start, &end);
-    }
+void merkle_touch(MerkleTree *tree, int line) {
+    int block = line / MERKLE_BLOCK_LINES;
+    if (tree->dirty != NULL && block < tree->leaves) tree->dirty[block] = 1;
 }
 
 /**
- * Atualiza o status na interface
+ * Marca para recálculo todos os blocos a partir do da linha line
+ * (inserção ou remoção: as linhas seguintes mudam de bloco)
  */
-void update_status(GtkWidget *widget, gpointer data) {
-    EditorData *editor = (EditorData *)data;
+void merkle_shift(MerkleTree *tree, int line) {
+    int block = line / MERKLE_BLOCK_LINES;
+    if (tree->shift_from < 0 || block < tree->shift_from) tree->shift_from = block;
+}
 
-    if (editor->editing_line >= 0) {
-        char status[256];
-        sprintf(status, "Editando linha %d", editor->editing_line + 1);
-        gtk_label_set_text(GTK_LABEL(editor->status_label), status);
-    } else {
-        int selected_line = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(editor->line_spin)) - 1;
-        if (editor->lines[selected_line].locked_by >= 0) {
-            char status[256];
-            sprintf(status, "Linha %d bloqueada por %s",
-                    selected_line + 1, editor->lines[selected_line].owner_name);
-            gtk_label_set_text(GTK_LABEL(editor->status_label), status);
+/**
+ * Nó da linha index (a partir de 0), ou NULL
+ */
+DocNode *document_node(Document *doc, int index) {
+    DocNode *node = doc->root;
+
+    while (node != NULL) {
+        int left = doc_size(node->left);
+        if (index < left) {
+            node = node->left;
+        } else if (index == left) {
+            return node;
         } else {
-            gtk_label_set_text(GTK_LABEL(editor->status_label), "Selecione uma linha para editar");
+            index -= left + 1;
+            node = node->right;
         }
     }
+    return NULL;
+}
+
+int document_line_count(Document *doc) {
+    return doc_size(doc->root);
 }
 
 /**
- * Processa atualizações da interface baseadas em mensagens MPI
+ * Conteúdo da linha index ("" se não existir)
  */
-gboolean update_interface(gpointer data) {
-    UpdateData *update = (UpdateData *)data;
-    EditorData *editor = update->editor;
-    Message *msg = &update->msg;
+const char *document_line(Document *doc, int index) {
+    DocNode *node = document_node(doc, index);
+    return node ? node->text : "";
+}
 
-    pthread_mutex_lock(&update_mutex);
+/**
+ * Substitui o conteúdo da linha index no próprio nó
+ */
+void document_set_line(Document *doc, int index, const char *text) {
+    DocNode *node = document_node(doc, index);
+    if (node == NULL) return;
 
-    switch (msg->type) {
-        case MSG_LINE_UPDATE:
-            editor->p_update = TRUE;
-            set_line_content(editor->text_buffer, msg->line_number, msg->content);
-            
-            char update_msg[256];
-            sprintf(update_msg, "%s atualizou linha %d", msg->sender_name, msg->line_number + 1);
+    g_free(node->text);
+    node->text = g_strdup(text);
+    merkle_touch(&doc->merkle, index);
+}
+
+/**
+ * Insere uma linha antes da posição index (index == contagem: no fim)
+ */
+void document_insert_line(Document *doc, int index, const char *text) {
+    DocNode *node = g_new0(DocNode, 1);
+    DocNode *left, *right;
+
+    node->priority = g_random_int();
+    node->size = 1;
+    node->text = g_strdup(text);
+
+    doc_split(doc->root, index, &left, &right);
+    doc->root = doc_merge(doc_merge(left, node), right);
+    merkle_shift(&doc->merkle, index);
+}
+
+/**
+ * Remove a linha index
+ */
+void document_delete_line(Document *doc, int index) {
+    DocNode *left, *middle, *right;
+
+    doc_split(doc->root, index, &left, &right);
+    doc_split(right, 1, &middle, &right);
+    doc_free_nodes(middle);
+    doc->root = doc_merge(left, right);
+    merkle_shift(&doc->merkle, index);
+}
+
+/**
+ * Recalcula o tamanho de todas as subárvores de node
+ */
+int doc_fix_sizes(DocNode *node) {
+    if (node == NULL) return 0;
+    node->size = 1 + doc_fix_sizes(node->left) + doc_fix_sizes(node->right);
+    return node->size;
+}
+
+/**
+ * Monta em O(n) a treap com os nós de nodes, já na ordem das linhas
+ * Árvore cartesiana: uma pilha guarda o caminho mais à direita, e cada nó
+ * novo adota como filho esquerdo o que sair dela por ter prioridade menor.
+ */
+DocNode *doc_build(DocNode **nodes, int count) {
+    DocNode **spine = g_new(DocNode *, count > 0 ? count : 1);
+    int top = 0;
+
+    for (int i = 0; i < count; i++) {
+        DocNode *node = nodes[i];
+        DocNode *last = NULL;
+        node->priority = g_random_int();
+        while (top > 0 && spine[top - 1]->priority < node->priority) last = spine[--top];
+        node->left = last;
+        if (top > 0) spine[top - 1]->right = node;
+        spine[top++] = node;
+    }
+
+    DocNode *root = top > 0 ? spine[0] : NULL;
+    g_free(spine);
+    doc_fix_sizes(root);
+    return root;
+}
+
+/**
+ * Cria um documento com count linhas vazias
+ */
+void document_init(Document *doc, int count) {
+    DocNode **nodes = g_new(DocNode *, count > 0 ? count : 1);
+    for (int i = 0; i < count; i++) {
+        nodes[i] = g_new0(DocNode, 1);
+        nodes[i]->text = g_strdup("");
+    }
+    doc->root = doc_build(nodes, count);
+    memset(&doc->merkle, 0, sizeof(doc->merkle));
+    g_free(nodes);
+}
+
+void document_free(Document *doc) {
+    doc_free_nodes(doc->root);
+    doc->root = NULL;
+    g_free(doc->merkle.nodes);
+    g_free(doc->merkle.dirty);
+    memset(&doc->merkle, 0, sizeof(doc->merkle));
+}
+
+/**
+ * Hash FNV-1a de 64 bits de data[0, len), continuando de hash
+ */
+guint64 merkle_hash(guint64 hash, const void *data, size_t len) {
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+/**
+ * Hash do conteúdo de uma linha
+ */
+guint64 merkle_line_hash(const char *text) {
+    return merkle_hash(14695981039346656037ull, text, strlen(text));
+}
+
+/**
+ * Hash de um bloco: os hashes das suas linhas, em ordem (0 se vazio)
+ */
+guint64 merkle_block_hash(Document *doc, int block) {
+    int count = document_line_count(doc);
+    int first = block * MERKLE_BLOCK_LINES;
+    int last = first + MERKLE_BLOCK_LINES < count ? first + MERKLE_BLOCK_LINES : count;
+    guint64 hash = 14695981039346656037ull;
+
+    if (first >= count) return 0;
+    for (int line = first; line < last; line++) {
+        guint64 line_hash = merkle_line_hash(document_line(doc, line));
+        hash = merkle_hash(hash, &line_hash, sizeof(line_hash));
+    }
+    return hash;
+}
+
+/**
+ * Atualiza a árvore de hashes do documento: só os blocos marcados desde a
+ * última chamada e seus caminhos até a raiz (tudo, se o número de folhas mudou)
+ */
+void merkle_refresh(Document *doc) {
+    MerkleTree *tree = &doc->merkle;
+    int blocks = (document_line_count(doc) + MERKLE_BLOCK_LINES - 1) / MERKLE_BLOCK_LINES;
+    int leaves = 1;
+    gboolean full = FALSE;
+
+    while (leaves < blocks) leaves <<= 1;
+    if (tree->nodes == NULL || leaves != tree->leaves) {
+        g_free(tree->nodes);
+        g_free(tree->dirty);
+        tree->nodes = g_new0(guint64, 2 * leaves);
+        tree->dirty = g_new0(guint8, leaves);
+        tree->leaves = leaves;
+        tree->shift_from = 0;
+        full = TRUE;
+    }
+    if (tree->shift_from >= 0) {
+        for (int b = tree->shift_from; b < leaves; b++) tree->dirty[b] = 1;
+        tree->shift_from = -1;
+    }
+
+    for (int b = 0; b < leaves; b++) {
+        if (!tree->dirty[b]) continue;
+        tree->dirty[b] = 0;
+        tree->nodes[leaves + b] = merkle_block_hash(doc, b);
+        if (full) continue;
+        for (int i = (leaves + b) / 2; i >= 1; i /= 2) {
+            guint64 pair[2] = {tree->nodes[2 * i], tree->nodes[2 * i + 1]};
+            tree->nodes[i] = merkle_hash(14695981039346656037ull, pair, sizeof(pair));
+        }
+    }
+    if (full) {
+        for (int i = leaves - 1; i >= 1; i--) {
+            guint64 pair[2] = {tree->nodes[2 * i], tree->nodes[2 * i + 1]};
+            tree->nodes[i] = merkle_hash(14695981039346656037ull, pair, sizeof(pair));
+        }
+    }
+}
+
+/**
+ * Checksum de 32 bits do texto base de um delta
+ */
+int line_checksum(const char *text) {
+    return (int)merkle_line_hash(text);
+}
+
+/**
+ * Codifica text em relação a base: prefixo e sufixo comuns e o trecho
+ * text[prefix, strlen(text) - suffix) que os substitui
+ * Retorna o tamanho do trecho, ou -1 se o delta não sai menor que a linha.
+ */
+int line_delta(const char *base, const char *text, int *prefix, int *suffix) {
+    int base_len = strlen(base);
+    int len = strlen(text);
+    int p = 0;
+    int q = 0;
+
+    if (len > MAX_LINE_LENGTH - 1) return -1;
+    while (p < base_len && p < len && base[p] == text[p]) p++;
+    while (q < base_len - p && q < len - p && base[base_len - 1 - q] == text[len - 1 - q]) q++;
+
+    int n = len - p - q;
+    if (n + DELTA_OVERHEAD >= len) return -1;
+    *prefix = p;
+    *suffix = q;
+    return n;
+}
+
+/**
+ * Reconstrói em out a linha de um delta sobre base
+ * Retorna 0 se o delta não cabe na base ou na linha.
+ */
+int line_delta_apply(const char *base, int prefix, int suffix, const char *piece, int n, char *out) {
+    int base_len = strlen(base);
+
+    if (prefix < 0 || suffix < 0 || n < 0 || prefix > base_len || suffix > base_len - prefix) return 0;
+    if (n > MAX_LINE_LENGTH - 1 - prefix - suffix) return 0;
+    memcpy(out, base, prefix);
+    memcpy(out + prefix, piece, n);
+    memcpy(out + prefix + n, base + base_len - suffix, suffix);
+    out[prefix + n + suffix] = '\0';
+    return 1;
+}
+
+/**
+ * Acrescenta a um lote a linha text, como delta sobre base se sair menor
+ * (base NULL: sempre inteira). Retorna o novo tamanho usado ou -1 se o
+ * registro não cabe.
+ */
+int batch_append_delta(char *buf, int used, int line, const char *base, const char *text) {
+    int prefix, suffix;
+    int n = base != NULL ? line_delta(base, text, &prefix, &suffix) : -1;
+
+    if (n < 0) return batch_append(buf, used, line, text);
+    if (used + 2 * (int)sizeof(int) + DELTA_OVERHEAD + n > COMM_BATCH_MAX_BYTES) return -1;
+
+    int length = -1 - n;
+    int delta[3] = {line_checksum(base), prefix, suffix};
+    memcpy(buf + used, &line, sizeof(int));
+    memcpy(buf + used + sizeof(int), &length, sizeof(int));
+    memcpy(buf + used + 2 * sizeof(int), delta, DELTA_OVERHEAD);
+    memcpy(buf + used + 2 * sizeof(int) + DELTA_OVERHEAD, text + prefix, n);
+    return used + 2 * sizeof(int) + DELTA_OVERHEAD + n;
+}
+
+/**
+ * Índice de linhas de data[0, len): (*starts)[i] é o início da linha i
+ * Cada thread OpenMP conta as quebras do seu pedaço com memchr (vetorizado
+ * na libc); as contagens viram deslocamentos e cada thread grava os inícios
+ * das linhas do seu pedaço. Retorna o número de quebras encontradas; o
+ * índice tem uma entrada a mais, para o texto depois da última quebra.
+ */
+size_t line_index_build(const char *data, size_t len, size_t **starts) {
+    int max_threads = omp_get_max_threads();
+    size_t *offsets = g_new0(size_t, max_threads + 1);
+    size_t *index = NULL;
+    size_t breaks = 0;
+
+    #pragma omp parallel
+    {
+        int t = omp_get_thread_num();
+        int nt = omp_get_num_threads();
+        size_t from = len / nt * t;
+        size_t to = t == nt - 1 ? len : len / nt * (t + 1);
+        size_t found = 0;
+
+        for (const char *p = data + from; p < data + to; p++) {
+            p = memchr(p, '\n', data + to - p);
+            if (p == NULL) break;
+            found++;
+        }
+        offsets[t + 1] = found;
+
+        #pragma omp barrier
+        #pragma omp single
+        {
+            for (int i = 1; i <= nt; i++) offsets[i] += offsets[i - 1];
+            breaks = offsets[nt];
+            index = g_new(size_t, breaks + 1);
+            index[0] = 0;
+        }
+
+        size_t k = offsets[t];
+        for (const char *p = data + from; p < data + to; p++) {
+            p = memchr(p, '\n', data + to - p);
+            if (p == NULL) break;
+            index[++k] = p - data + 1;
+        }
+    }
+
+    g_free(offsets);
+    *starts = index;
+    return breaks;
+}
+
+/**
+ * Monta o documento a partir do texto data[0, len), uma linha por '\n'
+ * As linhas são copiadas em paralelo: "\r\n" vira "\n", linhas maiores que
+ * MAX_LINE_LENGTH - 1 bytes são cortadas numa fronteira UTF-8 (contadas em
+ * *truncated) e bytes que não formam UTF-8 válido viram '?'.
+ * Retorna o número de linhas, ou -1 se passar de MAX_DOC_LINES.
+ */
+int document_parse(Document *doc, const char *data, size_t len, int *truncated) {
+    size_t *starts;
+    size_t breaks = line_index_build(data, len, &starts);
+    // Texto depois da última quebra (ou arquivo vazio) também é uma linha
+    size_t count = breaks + (len == 0 || data[len - 1] != '\n' ? 1 : 0);
+    int cut = 0;
+
+    if (count > MAX_DOC_LINES) {
+        g_free(starts);
+        return -1;
+    }
+
+    DocNode **nodes = g_new(DocNode *, count);
+    #pragma omp parallel for reduction(+:cut) schedule(static)
+    for (long i = 0; i < (long)count; i++) {
+        const char *line = data + starts[i];
+        size_t n = ((size_t)i < breaks ? starts[i + 1] - 1 : len) - starts[i];
+        const char *bad;
+
+        if (n > 0 && line[n - 1] == '\r') n--;
+        if (n > MAX_LINE_LENGTH - 1) {
+            n = MAX_LINE_LENGTH - 1;
+            while (n > 0 && ((unsigned char)line[n] & 0xC0) == 0x80) n--;
+            cut++;
+        }
+
+        nodes[i] = g_new0(DocNode, 1);
+        nodes[i]->text = g_strndup(line, n);
+        while (!g_utf8_validate(nodes[i]->text, -1, &bad)) *(char *)bad = '?';
+    }
+
+    doc->root = doc_build(nodes, count);
+    memset(&doc->merkle, 0, sizeof(doc->merkle));
+    g_free(nodes);
+    g_free(starts);
+    *truncated = cut;
+    return count;
+}
+
+/**
+ * Acrescenta a out as linhas de node em ordem, cada uma seguida de '\n'
+ */
+void doc_append(DocNode *node, GString *out) {
+    if (node == NULL) return;
+    doc_append(node->left, out);
+    g_string_append(out, node->text);
+    g_string_append_c(out, '\n');
+    doc_append(node->right, out);
+}
+
+/**
+ * Cria o documento inicial em todos os ranks (coletiva, antes do motor)
+ * Com --open, o rank 0 mapeia o arquivo com mmap e difunde os bytes em
+ * pedaços de DOC_BCAST_CHUNK; cada rank indexa e monta as linhas por conta
+ * própria, sem passar pela fila de mensagens. Um documento retomado do
+ * diário vai pelo mesmo caminho e tem precedência. Sem nenhum dos dois,
+ * são initial_lines linhas vazias.
+ */
+void document_distribute(EditorData *editor) {
+    long long size = -2;    // -1 = erro no rank 0, -2 = sem --open
+    char *data = NULL;
+    GString *recovered = NULL;
+    int fd = -1;
+
+    if (editor->rank == 0 && editor->journal != NULL && editor->journal->replayed >= 0) {
+        recovered = g_string_sized_new(JOURNAL_BUFFER_SIZE);
+        doc_append(editor->journal->recovered.root, recovered);
+        document_free(&editor->journal->recovered);
+        data = recovered->str;
+        size = recovered->len;
+    } else if (editor->rank == 0 && editor->open_path != NULL) {
+        struct stat st;
+        fd = open(editor->open_path, O_RDONLY);
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            fprintf(stderr, "Não foi possível abrir %s: %s\n", editor->open_path, strerror(errno));
+            size = -1;
+        } else {
+            size = st.st_size;
+        }
+        if (size > 0) {
+            data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                fprintf(stderr, "Não foi possível mapear %s: %s\n", editor->open_path, strerror(errno));
+                data = NULL;
+                size = -1;
+            } else {
+                madvise(data, size, MADV_SEQUENTIAL);
+            }
+        }
+    }
+
+    MPI_Bcast(&size, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+    if (size == -1) {
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    if (size == -2) {
+        document_init(&editor->doc, editor->initial_lines);
+        editor->loaded_bytes = -1;
+        editor->truncated_lines = 0;
+        return;
+    }
+
+    if (editor->rank != 0 && size > 0) data = g_malloc(size);
+    for (long long offset = 0; offset < size; offset += DOC_BCAST_CHUNK) {
+        int chunk = size - offset < DOC_BCAST_CHUNK ? (int)(size - offset) : DOC_BCAST_CHUNK;
+        MPI_Bcast(data + offset, chunk, MPI_CHAR, 0, MPI_COMM_WORLD);
+    }
+
+    int lines = document_parse(&editor->doc, data != NULL ? data : "", size, &editor->truncated_lines);
+
+    if (recovered != NULL) {
+        g_string_free(recovered, TRUE);
+    } else if (editor->rank == 0) {
+        if (data != NULL) munmap(data, size);
+        close(fd);
+    } else {
+        g_free(data);
+    }
+    if (lines < 0) {
+        if (editor->rank == 0) {
+            fprintf(stderr, "%s tem mais de %d linhas\n", editor->open_path, MAX_DOC_LINES);
+        }
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    editor->initial_lines = lines;
+    editor->loaded_bytes = size;
+}
+
+/**
+ * Escreve as linhas de node em ordem, cada uma seguida de '\n'
+ */
+void doc_write(DocNode *node, FILE *out) {
+    if (node == NULL) return;
+    doc_write(node->left, out);
+    fputs(node->text, out);
+    fputc('\n', out);
+    doc_write(node->right, out);
+}
+
+/**
+ * Grava o documento em path
+ * Escreve direto da treap em "path.tmp" com um buffer grande e só então
+ * troca o arquivo com rename: uma falha no meio não estraga o anterior.
+ * Retorna 0, ou -1 com errno indicando a falha.
+ */
+int document_save(Document *doc, const char *path) {
+    char *tmp = g_strdup_printf("%s.tmp", path);
+    FILE *out = fopen(tmp, "w");
+    int err;
+
+    if (out == NULL) {
+        err = errno;
+        g_free(tmp);
+        errno = err;
+        return -1;
+    }
+    setvbuf(out, NULL, _IOFBF, SAVE_BUFFER_SIZE);
+    doc_write(doc->root, out);
+
+    errno = EIO;
+    int failed = ferror(out) || fflush(out) != 0 || fsync(fileno(out)) != 0;
+    err = errno;
+    if (fclose(out) != 0 && !failed) {
+        failed = 1;
+        err = errno;
+    }
+    if (!failed && rename(tmp, path) != 0) {
+        failed = 1;
+        err = errno;
+    }
+    if (failed) unlink(tmp);
+    g_free(tmp);
+    errno = err;
+    return failed ? -1 : 0;
+}
+
+/**
+ * Soma FNV-1a de data[0, len), continuando de hash
+ * Detecta o registro rasgado no fim do diário depois de uma queda.
+ */
+guint32 journal_checksum(guint32 hash, const char *data, int len) {
+    for (int i = 0; i < len; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Acrescenta um registro ao diário (não toca no disco)
+ * Chamada com a mudança já aplicada ao documento; sem diário, não faz nada.
+ */
+void journal_append(Journal *j, int op, int line, const char *text) {
+    if (j == NULL) return;
+
+    char header[JOURNAL_RECORD_HEADER];
+    int n = text != NULL ? strlen(text) : 0;
+    int len = JOURNAL_RECORD_HEADER + n;
+
+    pthread_mutex_lock(&j->mutex);
+    gint64 seq = ++j->seq;
+    memcpy(header, &len, sizeof(int));
+    memcpy(header + 8, &seq, sizeof(gint64));
+    memcpy(header + 16, &op, sizeof(int));
+    memcpy(header + 20, &line, sizeof(int));
+    guint32 sum = journal_checksum(2166136261u, header + 8, JOURNAL_RECORD_HEADER - 8);
+    sum = journal_checksum(sum, text, n);
+    memcpy(header + 4, &sum, sizeof(guint32));
+    g_string_append_len(j->pending, header, JOURNAL_RECORD_HEADER);
+    g_string_append_len(j->pending, text, n);
+    j->since_snapshot++;
+    pthread_cond_signal(&j->cond);
+    pthread_mutex_unlock(&j->mutex);
+}
+
+/**
+ * Percorre os registros íntegros de data[0, len) e, se doc não for NULL,
+ * aplica os de sequência maior que *seq, avançando *seq
+ * Retorna o deslocamento do primeiro registro não percorrido (o fim, ou um
+ * registro rasgado); com stop_after >= 0, para antes do primeiro registro
+ * de sequência maior que stop_after.
+ */
+size_t journal_scan(const char *data, size_t len, Document *doc, gint64 *seq, gint64 stop_after, int *applied) {
+    size_t offset = 0;
+
+    while (offset + JOURNAL_RECORD_HEADER <= len) {
+        const char *record = data + offset;
+        int size, op, line;
+        guint32 sum;
+        gint64 rseq;
+
+        memcpy(&size, record, sizeof(int));
+        memcpy(&sum, record + 4, sizeof(guint32));
+        memcpy(&rseq, record + 8, sizeof(gint64));
+        memcpy(&op, record + 16, sizeof(int));
+        memcpy(&line, record + 20, sizeof(int));
+        if (size < JOURNAL_RECORD_HEADER || (size_t)size > len - offset) break;
+        if (journal_checksum(2166136261u, record + 8, size - 8) != sum) break;
+        if (stop_after >= 0 && rseq > stop_after) break;
+
+        if (doc != NULL && rseq > *seq) {
+            char *text = g_strndup(record + JOURNAL_RECORD_HEADER, size - JOURNAL_RECORD_HEADER);
+            int count = document_line_count(doc);
+            if (op == JOURNAL_SET && line >= 0 && line < count) {
+                document_set_line(doc, line, text);
+            } else if (op == JOURNAL_INSERT && line >= 0 && line <= count && count < MAX_DOC_LINES) {
+                document_insert_line(doc, line, text);
+            } else if (op == JOURNAL_DELETE && line >= 0 && line < count && count > 1) {
+                document_delete_line(doc, line);
+            }
+            g_free(text);
+            *seq = rseq;
+            (*applied)++;
+        }
+        offset += size;
+    }
+    return offset;
+}
+
+/**
+ * Grava todos os bytes de data em fd
+ */
+int write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * Torna durável um rename dentro de dir
+ */
+int journal_sync_dir(const char *dir) {
+    int fd = open(dir, O_RDONLY);
+    if (fd < 0) return -1;
+    int result = fsync(fd);
+    close(fd);
+    return result;
+}
+
+/**
+ * Grava DIR/snapshot com o texto do documento até o registro seq e troca
+ * DIR/journal por um diário só com tail (registros posteriores a seq)
+ * Cada arquivo é escrito ao lado e trocado com rename: uma queda no meio
+ * deixa o par anterior, e a retomada ignora registros já no snapshot.
+ */
+int journal_write_snapshot(Journal *j, GString *text, gint64 seq, const char *tail, size_t tail_len) {
+    char *path = g_strdup_printf("%s/snapshot", j->dir);
+    char *tmp = g_strdup_printf("%s/snapshot.tmp", j->dir);
+    char *journal_path = g_strdup_printf("%s/journal", j->dir);
+    char *journal_tmp = g_strdup_printf("%s/journal.tmp", j->dir);
+    char *header = g_strdup_printf(JOURNAL_SNAPSHOT_MAGIC " %lld\n", (long long)seq);
+    int result = -1;
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd >= 0) {
+        int failed = write_all(fd, header, strlen(header)) != 0 || write_all(fd, text->str, text->len) != 0 ||
+                     fsync(fd) != 0;
+        close(fd);
+        if (!failed && rename(tmp, path) == 0) {
+            fd = open(journal_tmp, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+            if (fd >= 0 && write_all(fd, tail, tail_len) == 0 && fsync(fd) == 0 &&
+                rename(journal_tmp, journal_path) == 0) {
+                if (j->fd >= 0) close(j->fd);
+                j->fd = fd;
+                result = journal_sync_dir(j->dir);
+            } else if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+
+    g_free(path);
+    g_free(tmp);
+    g_free(journal_path);
+    g_free(journal_tmp);
+    g_free(header);
+    return result;
+}
+
+/**
+ * Thread do diário: grava em grupos o que se acumulou em pending
+ * Um write e um fdatasync por grupo; o que chegar durante o fsync vai
+ * junto no grupo seguinte. Um snapshot pedido pela interface é gravado
+ * depois do grupo que contém o seu último registro.
+ */
+void *journal_writer(void *arg) {
+    Journal *j = (Journal *)arg;
+
+    pthread_mutex_lock(&j->mutex);
+    while (!j->stop || j->pending->len > 0 || j->snapshot != NULL) {
+        if (j->pending->len == 0 && j->snapshot == NULL) {
+            pthread_cond_wait(&j->cond, &j->mutex);
+            continue;
+        }
+
+        GString *group = j->pending;
+        GString *snapshot = j->snapshot;
+        gint64 snapshot_seq = j->snapshot_seq;
+        gint64 last = j->seq;
+        j->pending = g_string_sized_new(JOURNAL_BUFFER_SIZE);
+        j->snapshot = NULL;
+        pthread_mutex_unlock(&j->mutex);
+
+        int err = 0;
+        if (group->len > 0 && (write_all(j->fd, group->str, group->len) != 0 || fdatasync(j->fd) != 0)) {
+            err = errno;
+        }
+        if (err == 0 && snapshot != NULL) {
+            // Os registros do grupo posteriores ao snapshot passam para o diário novo
+            size_t split = journal_scan(group->str, group->len, NULL, NULL, snapshot_seq, NULL);
+            if (journal_write_snapshot(j, snapshot, snapshot_seq, group->str + split, group->len - split) != 0) {
+                err = errno;
+            }
+        }
+        g_string_free(group, TRUE);
+        if (snapshot != NULL) g_string_free(snapshot, TRUE);
+
+        pthread_mutex_lock(&j->mutex);
+        if (err != 0) {
+            j->error = err;
+        } else {
+            j->durable = last;
+            j->groups++;
+        }
+    }
+    pthread_mutex_unlock(&j->mutex);
+    return NULL;
+}
+
+/**
+ * Mapeia um arquivo inteiro para leitura
+ * Retorna NULL (com *len = 0) se ele não existe, está vazio ou não abre.
+ */
+char *file_map(const char *path, size_t *len) {
+    struct stat st;
+    char *data = NULL;
+    int fd = open(path, O_RDONLY);
+
+    *len = 0;
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            data = NULL;
+        } else {
+            *len = st.st_size;
+        }
+    }
+    close(fd);
+    return data;
+}
+
+/**
+ * Rank 0: prepara o diário de --journal e retoma o documento gravado nele
+ * Carrega DIR/snapshot e reaplica os registros íntegros de DIR/journal
+ * posteriores a ele; document_distribute difunde o resultado.
+ */
+void journal_prepare(EditorData *editor) {
+    Journal *j = g_new0(Journal, 1);
+    size_t len;
+
+    if (mkdir(editor->journal_dir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Não foi possível criar %s: %s\n", editor->journal_dir, strerror(errno));
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    j->dir = editor->journal_dir;
+    j->fd = -1;
+    j->replayed = -1;
+    pthread_mutex_init(&j->mutex, NULL);
+    pthread_cond_init(&j->cond, NULL);
+    j->pending = g_string_sized_new(JOURNAL_BUFFER_SIZE);
+    editor->journal = j;
+
+    char *path = g_strdup_printf("%s/snapshot", j->dir);
+    char *data = file_map(path, &len);
+    g_free(path);
+    if (data == NULL) return;
+
+    long long seq;
+    const char *body = memchr(data, '\n', len);
+    if (body == NULL || sscanf(data, JOURNAL_SNAPSHOT_MAGIC " %lld", &seq) != 1) {
+        fprintf(stderr, "%s/snapshot não é um snapshot do co-write\n", j->dir);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    body++;
+    int truncated;
+    if (document_parse(&j->recovered, body, data + len - body, &truncated) < 0) {
+        fprintf(stderr, "%s/snapshot tem mais de %d linhas\n", j->dir, MAX_DOC_LINES);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    munmap(data, len);
+
+    j->seq = seq;
+    j->replayed = 0;
+    path = g_strdup_printf("%s/journal", j->dir);
+    data = file_map(path, &len);
+    g_free(path);
+    if (data != NULL) {
+        journal_scan(data, len, &j->recovered, &j->seq, -1, &j->replayed);
+        munmap(data, len);
+    }
+}
+
+/**
+ * Rank 0: grava o snapshot inicial (o diário recomeça vazio, sem eventual
+ * registro rasgado) e inicia a thread do diário
+ */
+void journal_start(EditorData *editor) {
+    Journal *j = editor->journal;
+    GString *text = g_string_sized_new(JOURNAL_BUFFER_SIZE);
+
+    doc_append(editor->doc.root, text);
+    if (journal_write_snapshot(j, text, j->seq, "", 0) != 0) {
+        fprintf(stderr, "Não foi possível gravar o diário em %s: %s\n", j->dir, strerror(errno));
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    g_string_free(text, TRUE);
+    j->durable = j->seq;
+    pthread_create(&j->thread, NULL, journal_writer, j);
+}
+
+/**
+ * Entrega à thread do diário um snapshot do documento atual, com
+ * update_mutex já travado
+ * Copiar o texto é rápido, e com a trava o snapshot corresponde exatamente
+ * ao último registro já atribuído.
+ */
+void journal_snapshot_held(EditorData *editor) {
+    Journal *j = editor->journal;
+    GString *text = g_string_sized_new(JOURNAL_BUFFER_SIZE);
+
+    doc_append(editor->doc.root, text);
+    pthread_mutex_lock(&j->mutex);
+    if (j->snapshot != NULL) g_string_free(j->snapshot, TRUE);
+    j->snapshot = text;
+    j->snapshot_seq = j->seq;
+    j->since_snapshot = 0;
+    pthread_cond_signal(&j->cond);
+    pthread_mutex_unlock(&j->mutex);
+}
+
+/**
+ * Entrega à thread do diário um snapshot do documento atual
+ */
+void journal_snapshot(EditorData *editor) {
+    pthread_mutex_lock(&update_mutex);
+    journal_snapshot_held(editor);
+    pthread_mutex_unlock(&update_mutex);
+}
+
+/**
+ * Verificação periódica do diário na interface: pede um snapshot depois de
+ * JOURNAL_SNAPSHOT_RECORDS registros e registra falhas de gravação
+ */
+gboolean journal_tick(gpointer data) {
+    EditorData *editor = (EditorData *)data;
+    Journal *j = editor->journal;
+
+    if (!atomic_load(&running)) return G_SOURCE_REMOVE;
+
+    pthread_mutex_lock(&j->mutex);
+    int due = j->snapshot == NULL && j->since_snapshot >= JOURNAL_SNAPSHOT_RECORDS;
+    int error = j->error;
+    j->error = 0;
+    pthread_mutex_unlock(&j->mutex);
+
+    if (error != 0) {
+        char log_msg[512];
+        snprintf(log_msg, sizeof(log_msg), "Falha ao gravar o diário em %s: %s", j->dir, strerror(error));
+        append_log(editor, log_msg);
+    }
+    if (due) journal_snapshot(editor);
+    return G_SOURCE_CONTINUE;
+}
+
+/**
+ * Encerra o diário: último snapshot, grava o que falta e espera a thread
+ */
+void journal_close(EditorData *editor) {
+    Journal *j = editor->journal;
+
+    journal_snapshot(editor);
+    pthread_mutex_lock(&j->mutex);
+    j->stop = 1;
+    pthread_cond_signal(&j->cond);
+    pthread_mutex_unlock(&j->mutex);
+    pthread_join(j->thread, NULL);
+
+    if (j->error != 0) {
+        fprintf(stderr, "Falha ao gravar o diário em %s: %s\n", j->dir, strerror(j->error));
+    }
+    if (j->fd >= 0) close(j->fd);
+    g_string_free(j->pending, TRUE);
+    pthread_mutex_destroy(&j->mutex);
+    pthread_cond_destroy(&j->cond);
+    g_free(j);
+    editor->journal = NULL;
+}
+
+/**
+ * Tamanho do prefixo "NNNNNN| " que numera cada linha na visão
+ */
+int line_prefix_length(void) {
+    return LINE_NUMBER_DIGITS + 2;
+}
+
+/**
+ * Obtém da visão o conteúdo de uma linha (sem o prefixo)
+ * Usada para ler o que o usuário digitou; o resto do programa lê o documento.
+ */
+char *get_line_content(GtkTextBuffer *buffer, int line_num) {
+    GtkTextIter start, end;
+    gtk_text_buffer_get_iter_at_line_offset(buffer, &start, line_num, line_prefix_length());
+
+    end = start;
+    if (!gtk_text_iter_ends_line(&end)) {
+        gtk_text_iter_forward_to_line_end(&end);
+    }
+    return gtk_text_buffer_get_text(buffer, &start, &end, FALSE);
+}
+
+/**
+ * Projeta na visão o conteúdo de uma linha (sem tocar no prefixo)
+ */
+void set_line_content(GtkTextBuffer *buffer, int line_num, const char *text) {
+    GtkTextIter content_start, end;
+    gtk_text_buffer_get_iter_at_line_offset(buffer, &content_start, line_num, line_prefix_length());
+
+    end = content_start;
+    if (!gtk_text_iter_ends_line(&end)) {
+        gtk_text_iter_forward_to_line_end(&end);
+    }
+
+    gtk_text_buffer_delete(buffer, &content_start, &end);
+    gtk_text_buffer_insert(buffer, &content_start, text, -1);
+}
+
+/**
+ * Escreve uma linha no documento e atualiza só essa linha na visão
+ */
+void editor_set_line(EditorData *editor, int line_num, const char *text) {
+    // Uma resposta a um MSG_LINE_REFETCH anterior traria um texto mais antigo
+    g_hash_table_remove(editor->refetches, GINT_TO_POINTER(line_num));
+    document_set_line(&editor->doc, line_num, text);
+    journal_append(editor->journal, JOURNAL_SET, line_num, text);
+    if (!editor->headless) set_line_content(editor->text_buffer, line_num, text);
+}
+
+/**
+ * Texto que o usuário tem na linha: o da visão, ou o do documento sem interface
+ */
+char *editor_line_text(EditorData *editor, int line_num) {
+    if (editor->headless) return g_strdup(document_line(&editor->doc, line_num));
+    return get_line_content(editor->text_buffer, line_num);
+}
+
+/**
+ * Reescreve a numeração das linhas da visão a partir de from
+ */
+void view_renumber(EditorData *editor, int from) {
+    int count = document_line_count(&editor->doc);
+    char number[16];
+
+    for (int line = from; line < count; line++) {
+        GtkTextIter start, end;
+        gtk_text_buffer_get_iter_at_line(editor->text_buffer, &start, line);
+        gtk_text_buffer_get_iter_at_line_offset(editor->text_buffer, &end, line, LINE_NUMBER_DIGITS);
+        gtk_text_buffer_delete(editor->text_buffer, &start, &end);
+        sprintf(number, "%0*d", LINE_NUMBER_DIGITS, line + 1);
+        gtk_text_buffer_insert(editor->text_buffer, &start, number, -1);
+    }
+}
+
+/**
+ * Projeta na visão uma linha inserida no documento na posição line
+ */
+void view_insert_line(EditorData *editor, int line, const char *text) {
+    if (editor->headless) return;
+
+    GtkTextIter iter;
+    char *row = g_strdup_printf("%0*d| %s\n", LINE_NUMBER_DIGITS, line + 1, text);
+    gtk_text_buffer_get_iter_at_line(editor->text_buffer, &iter, line);
+    gtk_text_buffer_insert(editor->text_buffer, &iter, row, -1);
+    g_free(row);
+    view_renumber(editor, line + 1);
+}
+
+/**
+ * Tira da visão a linha line, já removida do documento
+ */
+void view_delete_line(EditorData *editor, int line) {
+    if (editor->headless) return;
+
+    GtkTextIter start, end;
+    gtk_text_buffer_get_iter_at_line(editor->text_buffer, &start, line);
+    end = start;
+    gtk_text_iter_forward_line(&end);
+    gtk_text_buffer_delete(editor->text_buffer, &start, &end);
+    view_renumber(editor, line);
+}
+
+/**
+ * Indica se o estado de uma linha é o de uma linha nunca tocada
+ */
+int line_info_is_free(const LineInfo *info) {
+    return info->locked_by < 0 && info->fence == 0 && info->version == 0 && info->epoch == 0;
+}
+
+/**
+ * Estado de uma linha para leitura (linhas sem entrada estão livres)
+ */
+const LineInfo *line_peek(EditorData *editor, int line) {
+    static const LineInfo free_line = {-1, 0, 0, 0, 0, 0};
+    LineInfo *info = g_hash_table_lookup(editor->line_state, GINT_TO_POINTER(line));
+    return info != NULL ? info : &free_line;
+}
+
+/**
+ * Estado de uma linha para escrita, criado livre no primeiro uso
+ */
+LineInfo *line_info(EditorData *editor, int line) {
+    LineInfo *info = g_hash_table_lookup(editor->line_state, GINT_TO_POINTER(line));
+    if (info == NULL) {
+        info = g_new0(LineInfo, 1);
+        info->locked_by = -1;
+        g_hash_table_insert(editor->line_state, GINT_TO_POINTER(line), info);
+    }
+    return info;
+}
+
+/**
+ * Muda o dono de uma linha (-1 = livre)
+ * Uma linha que volta ao estado livre sai da tabela: o custo em memória
+ * acompanha os bloqueios ativos, não o tamanho do documento.
+ */
+void line_set_owner(EditorData *editor, int line, int owner) {
+    if (owner < 0 && g_hash_table_lookup(editor->line_state, GINT_TO_POINTER(line)) == NULL) return;
+
+    LineInfo *info = line_info(editor, line);
+    info->locked_by = owner;
+    if (owner >= 0) return;
+
+    info->token = 0;
+    // A barreira da última escrita vale mais um pouco fora da tabela: um lote
+    // repassado pela árvore de difusão pode chegar depois da liberação
+    if (info->written > 0) {
+        g_hash_table_insert(editor->released_writes, GINT_TO_POINTER(line), GINT_TO_POINTER(info->written));
+    }
+    info->written = 0;
+    if (line_info_is_free(info)) g_hash_table_remove(editor->line_state, GINT_TO_POINTER(line));
+}
+
+/**
+ * Destaca uma linha com cor baseada no status de bloqueio
+ * Usa as tags "mine"/"other" criadas em main() e só toca a linha indicada.
+ */
+void highlight_line(EditorData *editor, int line_num) {
+    if (editor->headless) return;
+
+    GtkTextIter start, end;
+    gtk_text_buffer_get_iter_at_line(editor->text_buffer, &start, line_num);
+    end = start;
+    gtk_text_iter_forward_line(&end);
+
+    gtk_text_buffer_remove_tag_by_name(editor->text_buffer, "mine", &start, &end);
+    gtk_text_buffer_remove_tag_by_name(editor->text_buffer, "other", &start, &end);
+
+    int owner = line_peek(editor, line_num)->locked_by;
+    if (owner == editor->rank) {
+        // Verde para linha editada pelo usuário atual
+        gtk_text_buffer_apply_tag_by_name(editor->text_buffer, "mine", &start, &end);
+    } else if (owner >= 0) {
+        // Rosa para linha editada por outro usuário
+        gtk_text_buffer_apply_tag_by_name(editor->text_buffer, "other", &start, &end);
+    }
+}
+
+/**
+ * Destaca as linhas de [start, end)
+ */
+void highlight_range(EditorData *editor, int start, int end) {
+    for (int line = start; line < end; line++) {
+        highlight_line(editor, line);
+    }
+}
+
+/**
+ * Refaz a visão inteira a partir do documento: numeração, texto e destaques
+ */
+void view_reset(EditorData *editor) {
+    int count = document_line_count(&editor->doc);
+    GString *text = g_string_sized_new(count * (line_prefix_length() + 1));
+
+    for (int i = 0; i < count; i++) {
+        g_string_append_printf(text, "%0*d| %s\n", LINE_NUMBER_DIGITS, i + 1, document_line(&editor->doc, i));
+    }
+    editor->p_update = TRUE;
+    gtk_text_buffer_set_text(editor->text_buffer, text->str, text->len);
+    editor->p_update = FALSE;
+    g_string_free(text, TRUE);
+
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, editor->line_state);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        int line = GPOINTER_TO_INT(key);
+        if (((LineInfo *)value)->locked_by >= 0 && line < count) highlight_line(editor, line);
+    }
+}
+
+/**
+ * Descreve [start, end) para o log: "linha 3" ou "linhas 3–10"
+ */
+void describe_range(char *buffer, size_t size, int start, int end) {
+    if (end - start == 1) {
+        snprintf(buffer, size, "linha %d", start + 1);
+    } else {
+        snprintf(buffer, size, "linhas %d–%d", start + 1, end);
+    }
+}
+
+/**
+ * Atualiza o status na interface
+ */
+void update_status(GtkWidget *widget, gpointer data) {
+    EditorData *editor = (EditorData *)data;
+
+    if (editor->headless) return;
+    if (editor->batching && widget == NULL) {
+        editor->status_dirty = TRUE;
+        return;
+    }
+
+    if (editor->editing_line >= 0) {
+        char range[64];
+        char status[256];
+        describe_range(range, sizeof(range), editor->editing_line, editor->editing_end);
+        sprintf(status, "Editando %s", range);
+        gtk_label_set_text(GTK_LABEL(editor->status_label), status);
+    } else if (editor->waiting_line >= 0) {
+        char range[64];
+        char status[256];
+        describe_range(range, sizeof(range), editor->waiting_line, editor->waiting_end);
+        if (editor->queue_position > 0) {
+            sprintf(status, "Aguardando %s (posição %d na fila)", range, editor->queue_position);
+        } else {
+            sprintf(status, "Aguardando %s", range);
+        }
+        gtk_label_set_text(GTK_LABEL(editor->status_label), status);
+    } else {
+        int selected_line = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(editor->line_spin)) - 1;
+        const LineInfo *info = line_peek(editor, selected_line);
+        if (info->locked_by >= 0) {
+            char status[256];
+            sprintf(status, "Linha %d bloqueada por %s", selected_line + 1,
+                    user_name(editor, info->locked_by));
+            gtk_label_set_text(GTK_LABEL(editor->status_label), status);
+        } else {
+            gtk_label_set_text(GTK_LABEL(editor->status_label), "Selecione uma linha para editar");
+        }
+    }
+}
+
+/**
+ * Ordem total dos ids do RGA: carimbo, depois rank
+ */
+int crdt_id_cmp(int counter_a, int rank_a, int counter_b, int rank_b) {
+    if (counter_a != counter_b) return counter_a < counter_b ? -1 : 1;
+    if (rank_a != rank_b) return rank_a < rank_b ? -1 : 1;
+    return 0;
+}
+
+/**
+ * Estado CRDT de uma linha, criado a partir do texto do documento
+ * Todos os ranks chegam ao mesmo texto base: ele só muda por substituições
+ * inteiras, aplicadas em todos, e cada uma descarta o estado (crdt_line_reset).
+ */
+CrdtLine *crdt_line_get(EditorData *editor, int line) {
+    CrdtLine *cl = g_hash_table_lookup(editor->crdt_lines, GINT_TO_POINTER(line));
+    if (cl != NULL) return cl;
+
+    cl = g_new0(CrdtLine, 1);
+    const char *text = document_line(&editor->doc, line);
+    cl->cap = g_utf8_strlen(text, -1) + 16;
+    cl->elems = g_new(CrdtElem, cl->cap);
+
+    for (const char *p = text; *p; p = g_utf8_next_char(p)) {
+        CrdtElem *e = &cl->elems[cl->len];
+        e->counter = 0;
+        e->rank = -1 - cl->len;
+        e->ch = g_utf8_get_char(p);
+        e->del_counter = 0;
+        e->del_rank = 0;
+        cl->len++;
+    }
+
+    g_hash_table_insert(editor->crdt_lines, GINT_TO_POINTER(line), cl);
+    return cl;
+}
+
+/**
+ * Libera o estado CRDT de uma linha (destrutor da tabela crdt_lines)
+ */
+void crdt_line_free(gpointer data) {
+    CrdtLine *cl = data;
+    g_free(cl->elems);
+    g_free(cl);
+}
+
+/**
+ * Descarta o estado CRDT de uma linha substituída por inteiro
+ * Operações feitas sobre o texto anterior chegam com epoch antigo e são ignoradas.
+ */
+void crdt_line_reset(EditorData *editor, int line) {
+    g_hash_table_remove(editor->crdt_lines, GINT_TO_POINTER(line));
+    line_info(editor, line)->epoch++;
+}
+
+/**
+ * Copia para o documento o texto visível de uma linha CRDT
+ */
+void crdt_sync_document(EditorData *editor, int line, CrdtLine *cl) {
+    char *text = g_malloc(cl->len * 6 + 1);
+    int used = 0;
+
+    for (int i = 0; i < cl->len; i++) {
+        if (cl->elems[i].del_counter == 0) {
+            used += g_unichar_to_utf8(cl->elems[i].ch, text + used);
+        }
+    }
+    text[used] = '\0';
+    document_set_line(&editor->doc, line, text);
+    journal_append(editor->journal, JOURNAL_SET, line, text);
+    g_free(text);
+}
+
+/**
+ * Posição de um id na linha (incluindo lápides), ou -1
+ */
+int crdt_find(CrdtLine *cl, int counter, int rank) {
+    for (int i = 0; i < cl->len; i++) {
+        if (cl->elems[i].counter == counter && cl->elems[i].rank == rank) return i;
+    }
+    return -1;
+}
+
+/**
+ * Número de elementos visíveis antes da posição pos
+ */
+int crdt_visible_before(CrdtLine *cl, int pos) {
+    int visible = 0;
+    for (int i = 0; i < pos; i++) {
+        if (cl->elems[i].del_counter == 0) visible++;
+    }
+    return visible;
+}
+
+/**
+ * Posição do n-ésimo elemento visível (a partir de 0), ou -1
+ */
+int crdt_visible_at(CrdtLine *cl, int n) {
+    for (int i = 0; i < cl->len; i++) {
+        if (cl->elems[i].del_counter != 0) continue;
+        if (n-- == 0) return i;
+    }
+    return -1;
+}
+
+/**
+ * Marca a chegada de uma operação de rank com último carimbo counter
+ */
+void crdt_observe(EditorData *editor, int rank, int counter) {
+    if (counter > editor->crdt_clock) editor->crdt_clock = counter;
+    if (counter > editor->crdt_seen[rank]) {
+        editor->crdt_seen[rank] = counter;
+        editor->crdt_seen_dirty = TRUE;
+    }
+}
+
+/**
+ * Integra uma inserção: msg->content a partir do carimbo args[0], depois do
+ * elemento (args[1], args[2]) ou no início da linha se args[1] == CRDT_ROOT
+ * Regra do RGA: a partir da referência, pula os elementos de id maior, que
+ * são inserções concorrentes com prioridade. Com apply_view, reflete o
+ * resultado no buffer. Retorna 0 se a referência ainda não chegou.
+ */
+int crdt_integrate_insert(EditorData *editor, CrdtLine *cl, const Message *msg, int apply_view) {
+    int counter = msg->args[0];
+    int rank = msg->sender_rank;
+    int pos = 0;
+
+    if (crdt_find(cl, counter, rank) >= 0) return 1; // duplicada
+    if (msg->args[1] != CRDT_ROOT) {
+        int ref = crdt_find(cl, msg->args[1], msg->args[2]);
+        if (ref < 0) return 0;
+        pos = ref + 1;
+    }
+    while (pos < cl->len &&
+           crdt_id_cmp(cl->elems[pos].counter, cl->elems[pos].rank, counter, rank) > 0) {
+        pos++;
+    }
+
+    int n = g_utf8_strlen(msg->content, -1);
+    if (cl->len + n > cl->cap) {
+        cl->cap = (cl->len + n) * 2;
+        cl->elems = g_realloc(cl->elems, cl->cap * sizeof(CrdtElem));
+    }
+    memmove(&cl->elems[pos + n], &cl->elems[pos], (cl->len - pos) * sizeof(CrdtElem));
+
+    // Os caracteres seguintes têm como referência o anterior e ids maiores
+    // que tudo o que vem depois: ficam contíguos
+    const char *p = msg->content;
+    for (int k = 0; k < n; k++, p = g_utf8_next_char(p)) {
+        CrdtElem *e = &cl->elems[pos + k];
+        e->counter = counter + k;
+        e->rank = rank;
+        e->ch = g_utf8_get_char(p);
+        e->del_counter = 0;
+        e->del_rank = 0;
+    }
+    cl->len += n;
+    crdt_observe(editor, rank, counter + n - 1);
+
+    if (apply_view && n > 0) {
+        GtkTextIter iter;
+        int offset = line_prefix_length() +
+                     crdt_visible_before(cl, pos);
+        gtk_text_buffer_get_iter_at_line_offset(editor->text_buffer, &iter, msg->line_number, offset);
+        gtk_text_buffer_insert(editor->text_buffer, &iter, msg->content, -1);
+    }
+    crdt_sync_document(editor, msg->line_number, cl);
+    return 1;
+}
+
+/**
+ * Integra uma remoção do elemento (args[0], args[1]) com carimbo args[2]
+ * Retorna 0 se o elemento ainda não chegou.
+ */
+int crdt_integrate_delete(EditorData *editor, CrdtLine *cl, const Message *msg, int apply_view) {
+    int pos = crdt_find(cl, msg->args[0], msg->args[1]);
+    if (pos < 0) return 0;
+
+    CrdtElem *e = &cl->elems[pos];
+    crdt_observe(editor, msg->sender_rank, msg->args[2]);
+    if (e->del_counter != 0) return 1; // remoção concorrente já aplicada
+
+    e->del_counter = msg->args[2];
+    e->del_rank = msg->sender_rank;
+
+    if (apply_view) {
+        GtkTextIter start, end;
+        int offset = line_prefix_length() +
+                     crdt_visible_before(cl, pos);
+        gtk_text_buffer_get_iter_at_line_offset(editor->text_buffer, &start, msg->line_number, offset);
+        end = start;
+        gtk_text_iter_forward_char(&end);
+        gtk_text_buffer_delete(editor->text_buffer, &start, &end);
+    }
+    crdt_sync_document(editor, msg->line_number, cl);
+    return 1;
+}
+
+/**
+ * Tenta integrar uma operação remota
+ * Retorna 0 se ela depende de algo que ainda não chegou.
+ */
+int crdt_try_apply(EditorData *editor, const Message *msg) {
+    int line = msg->line_number;
+    int epoch = msg->args[3];
+    int last = msg->type == MSG_CRDT_INSERT
+        ? msg->args[0] + (int)g_utf8_strlen(msg->content, -1) - 1
+        : msg->args[2];
+
+    int current = line_peek(editor, line)->epoch;
+    if (epoch < current) {
+        // Feita sobre um texto que já foi substituído por inteiro
+        crdt_observe(editor, msg->sender_rank, last);
+        return 1;
+    }
+    if (epoch > current) return 0;
+
+    CrdtLine *cl = crdt_line_get(editor, line);
+    int done;
+    editor->p_update = TRUE;
+    if (msg->type == MSG_CRDT_INSERT) {
+        done = crdt_integrate_insert(editor, cl, msg, !editor->headless);
+    } else {
+        done = crdt_integrate_delete(editor, cl, msg, !editor->headless);
+    }
+    editor->p_update = FALSE;
+    return done;
+}
+
+/**
+ * Integra as operações em espera cujas dependências já chegaram
+ */
+void crdt_retry_pending(EditorData *editor) {
+    int progress = TRUE;
+    gboolean *stuck = g_new(gboolean, editor->size);
+    while (progress && !g_queue_is_empty(&editor->crdt_pending)) {
+        progress = FALSE;
+        memset(stuck, 0, editor->size * sizeof(gboolean));
+        GList *node = editor->crdt_pending.head;
+        while (node != NULL) {
+            GList *next = node->next;
+            Message *pending = node->data;
+            if (!stuck[pending->sender_rank] && crdt_try_apply(editor, pending)) {
+                g_queue_delete_link(&editor->crdt_pending, node);
+                g_free(pending);
+                progress = TRUE;
+            } else {
+                stuck[pending->sender_rank] = TRUE;
+            }
+            node = next;
+        }
+    }
+    g_free(stuck);
+}
+
+/**
+ * Recebe uma operação CRDT de outro rank
+ * As operações de um mesmo rank são integradas na ordem de envio: se uma
+ * espera dependência, as seguintes dele esperam atrás dela.
+ */
+void crdt_receive(EditorData *editor, const Message *msg) {
+    if (msg->line_number < 0 || msg->line_number >= document_line_count(&editor->doc)) return;
+    if (msg->sender_rank < 0 || msg->sender_rank >= editor->size) return;
+
+    int blocked = FALSE;
+    for (GList *node = editor->crdt_pending.head; node != NULL && !blocked; node = node->next) {
+        blocked = ((Message *)node->data)->sender_rank == msg->sender_rank;
+    }
+    if (blocked || !crdt_try_apply(editor, msg)) {
+        Message *copy = g_new(Message, 1);
+        *copy = *msg;
+        g_queue_push_tail(&editor->crdt_pending, copy);
+        return;
+    }
+    crdt_retry_pending(editor);
+}
+
+/**
+ * Gera e difunde a inserção local de text na posição visível offset
+ * Chamada antes de o GTK inserir o texto no buffer.
+ */
+void crdt_local_insert(EditorData *editor, int line, int offset, const char *text, int len) {
+    CrdtLine *cl = crdt_line_get(editor, line);
+    Message msg;
+    int n = len < MAX_LINE_LENGTH - 1 ? len : MAX_LINE_LENGTH - 1;
+
+    msg.type = MSG_CRDT_INSERT;
+    msg.line_number = line;
+    msg.sender_rank = editor->rank;
+    memcpy(msg.content, text, n);
+    msg.content[n] = '\0';
+    msg.args[0] = editor->crdt_clock + 1;
+    msg.args[1] = CRDT_ROOT;
+    msg.args[2] = 0;
+    msg.args[3] = line_peek(editor, line)->epoch;
+
+    int ref = offset > 0 ? crdt_visible_at(cl, offset - 1) : -1;
+    if (ref >= 0) {
+        msg.args[1] = cl->elems[ref].counter;
+        msg.args[2] = cl->elems[ref].rank;
+    }
+
+    crdt_integrate_insert(editor, cl, &msg, FALSE);
+    comm_broadcast(&msg);
+}
+
+/**
+ * Gera e difunde a remoção local dos caracteres visíveis [start, end)
+ * Chamada antes de o GTK remover o texto do buffer.
+ */
+void crdt_local_delete(EditorData *editor, int line, int start, int end) {
+    CrdtLine *cl = crdt_line_get(editor, line);
+
+    // As posições visíveis mudam a cada remoção: remove sempre em start
+    for (int k = start; k < end; k++) {
+        int pos = crdt_visible_at(cl, start);
+        if (pos < 0) break;
+
+        Message msg;
+        msg.type = MSG_CRDT_DELETE;
+        msg.line_number = line;
+        msg.sender_rank = editor->rank;
+        msg.args[0] = cl->elems[pos].counter;
+        msg.args[1] = cl->elems[pos].rank;
+        msg.args[2] = editor->crdt_clock + 1;
+        msg.args[3] = line_peek(editor, line)->epoch;
+
+        crdt_integrate_delete(editor, cl, &msg, FALSE);
+        comm_broadcast(&msg);
+    }
+}
+
+/**
+ * Registra o vetor de operações integradas anunciado por outro rank
+ */
+void crdt_on_ack(EditorData *editor, const Message *msg, const char *payload, int len) {
+    if (msg->sender_rank < 0 || msg->sender_rank >= editor->size) return;
+    if (len != editor->size * (int)sizeof(int)) return;
+    memcpy(&editor->crdt_reports[msg->sender_rank * editor->size], payload, len);
+}
+
+/**
+ * Remove as lápides estáveis: todos os ranks já integraram a remoção, e
+ * pela ordem FIFO entre cada par também tudo o que enviaram antes dela, de
+ * modo que nenhuma operação futura pode referenciá-las
+ */
+void crdt_purge(EditorData *editor) {
+    if (!g_queue_is_empty(&editor->crdt_pending)) return;
+
+    int *stable = g_new(int, editor->size);
+    for (int r = 0; r < editor->size; r++) {
+        stable[r] = editor->crdt_seen[r];
+        for (int j = 0; j < editor->size; j++) {
+            if (j == editor->rank) continue;
+            int reported = editor->crdt_reports[j * editor->size + r];
+            if (reported < stable[r]) stable[r] = reported;
+        }
+    }
+
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, editor->crdt_lines);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        CrdtLine *cl = value;
+        int kept = 0;
+        for (int i = 0; i < cl->len; i++) {
+            CrdtElem *e = &cl->elems[i];
+            if (e->del_counter != 0 && e->del_counter <= stable[e->del_rank]) continue;
+            cl->elems[kept++] = *e;
+        }
+        cl->len = kept;
+    }
+    g_free(stable);
+}
+
+/**
+ * Anuncia periodicamente o vetor de operações integradas e limpa lápides
+ */
+gboolean crdt_gc_tick(gpointer data) {
+    EditorData *editor = (EditorData *)data;
+
+    pthread_mutex_lock(&update_mutex);
+    if (editor->crdt_seen_dirty) {
+        WireHeader header;
+        header.type = MSG_CRDT_ACK;
+        header.line_number = 0;
+        header.sender_rank = editor->rank;
+        header.length = editor->size * sizeof(int);
+        comm_send_frame(COMM_BROADCAST, &header, editor->crdt_seen);
+        editor->crdt_seen_dirty = FALSE;
+    }
+    crdt_purge(editor);
+    pthread_mutex_unlock(&update_mutex);
+
+    return G_SOURCE_CONTINUE;
+}
+
+/**
+ * Indica se uma escrita feita sob token deve ser recusada: a concessão
+ * correspondente já foi recolhida por expiração, ou a linha já tem uma
+ * escrita mais nova, da concessão atual ou de uma liberada há pouco
+ */
+int update_is_fenced(EditorData *editor, int line, int token) {
+    if (line < 0 || line >= document_line_count(&editor->doc)) return 1;
+    const LineInfo *info = line_peek(editor, line);
+    if (token <= 0) return 0;
+    return token <= info->fence || token < info->written ||
+           token < GPOINTER_TO_INT(g_hash_table_lookup(editor->released_writes, GINT_TO_POINTER(line))) ||
+           token < GPOINTER_TO_INT(g_hash_table_lookup(editor->released_before, GINT_TO_POINTER(line)));
+}
+
+/**
+ * Esquece as últimas escritas das linhas liberadas há mais de um período
+ * A memória acompanha as linhas liberadas nos dois últimos períodos.
+ */
+gboolean released_writes_tick(gpointer data) {
+    EditorData *editor = (EditorData *)data;
+
+    pthread_mutex_lock(&update_mutex);
+    GHashTable *before = editor->released_before;
+    editor->released_before = editor->released_writes;
+    editor->released_writes = before;
+    g_hash_table_remove_all(editor->released_writes);
+    pthread_mutex_unlock(&update_mutex);
+    return G_SOURCE_CONTINUE;
+}
+
+/**
+ * Registra uma escrita sob token numa linha bloqueada: até a liberação, a
+ * escrita de um dono anterior que chegue depois dela é recusada
+ * Linhas sem dono não ganham estado; na liberação, a barreira passa para
+ * released_writes.
+ */
+void line_mark_written(EditorData *editor, int line, int token) {
+    LineInfo *info = g_hash_table_lookup(editor->line_state, GINT_TO_POINTER(line));
+    if (info != NULL && info->locked_by >= 0 && token > info->written) info->written = token;
+}
+
+/**
+ * Habilita a edição de [start, end) e posiciona o cursor na primeira linha
+ * No modo otimista guarda a versão de cada linha, que será a base do commit.
+ */
+void editor_begin_editing(EditorData *editor, int start, int end) {
+    editor->editing_line = start;
+    editor->editing_end = end;
+
+    if (editor->edit_mode != EDIT_MODE_CRDT) {
+        editor->edit_text = g_new(char *, end - start);
+        for (int line = start; line < end; line++) {
+            editor->edit_text[line - start] = g_strdup(document_line(&editor->doc, line));
+        }
+    }
+    if (editor->edit_mode == EDIT_MODE_OPTIMISTIC) {
+        editor->edit_base = g_new(int, end - start);
+        editor->edit_stash = g_new0(char *, end - start);
+        for (int line = start; line < end; line++) {
+            editor->edit_base[line - start] = line_peek(editor, line)->version;
+        }
+    }
+
+    // Backup da primeira linha
+    strncpy(editor->line_backup, document_line(&editor->doc, start), MAX_LINE_LENGTH - 1);
+    if (editor->headless) return;
+
+    // Atualiza interface
+    gtk_widget_set_sensitive(editor->edit_button, FALSE);
+    gtk_widget_set_sensitive(editor->commit_button, TRUE);
+    gtk_widget_set_sensitive(editor->line_spin, FALSE);
+    gtk_widget_set_sensitive(editor->range_spin, FALSE);
+    gtk_text_view_set_editable(GTK_TEXT_VIEW(editor->text_view), TRUE);
+
+    highlight_range(editor, start, end);
+    update_status(NULL, editor);
+
+    // Posiciona cursor após o identificador
+    GtkTextIter iter;
+    gtk_text_buffer_get_iter_at_line(editor->text_buffer, &iter, start);
+    while (!gtk_text_iter_ends_line(&iter)) {
+        if (gtk_text_iter_get_char(&iter) == '|') {
+            gtk_text_iter_forward_char(&iter);
+            if (gtk_text_iter_get_char(&iter) == ' ') {
+                gtk_text_iter_forward_char(&iter);
+            }
+            break;
+        }
+        gtk_text_iter_forward_char(&iter);
+    }
+    gtk_text_buffer_place_cursor(editor->text_buffer, &iter);
+}
+
+/**
+ * Volta a interface ao estado de leitura
+ */
+void editor_end_editing(EditorData *editor) {
+    if (editor->edit_stash != NULL) {
+        for (int i = 0; i < editor->editing_end - editor->editing_line; i++) {
+            g_free(editor->edit_stash[i]);
+        }
+    }
+    if (editor->edit_text != NULL) {
+        for (int i = 0; i < editor->editing_end - editor->editing_line; i++) {
+            g_free(editor->edit_text[i]);
+        }
+    }
+    g_free(editor->edit_stash);
+    g_free(editor->edit_base);
+    g_free(editor->edit_text);
+    editor->edit_stash = NULL;
+    editor->edit_base = NULL;
+    editor->edit_text = NULL;
+
+    editor->editing_line = -1;
+    editor->editing_end = -1;
+    if (editor->headless) return;
+
+    gtk_widget_set_sensitive(editor->edit_button, TRUE);
+    gtk_widget_set_sensitive(editor->commit_button, FALSE);
+    gtk_widget_set_sensitive(editor->line_spin, TRUE);
+    gtk_widget_set_sensitive(editor->range_spin, TRUE);
+    gtk_text_view_set_editable(GTK_TEXT_VIEW(editor->text_view), FALSE);
+    update_status(NULL, editor);
+}
+
+/**
+ * Recebe uma escrita numerada pelo home no modo otimista
+ * Se a linha está sendo editada aqui, o texto do usuário não é tocado: a
+ * escrita fica guardada e o commit dessa linha vai falhar por conflito.
+ * Retorna TRUE se a escrita foi retida.
+ */
+int optimistic_receive(EditorData *editor, int line, int version, const char *text, int sender) {
+    line_info(editor, line)->version = version;
+    if (editor->edit_base == NULL || line < editor->editing_line || line >= editor->editing_end) {
+        return FALSE;
+    }
+
+    int i = line - editor->editing_line;
+    if (sender == editor->rank && editor->edit_base[i] == version - 1) {
+        // Eco do commit anterior deste usuário: nova base, mesmo texto
+        editor->edit_base[i] = version;
+        return TRUE;
+    }
+    g_free(editor->edit_stash[i]);
+    editor->edit_stash[i] = g_strdup(text);
+    return TRUE;
+}
+
+/**
+ * Último texto aceito de uma linha, base dos deltas que chegam para ela
+ * Numa linha em edição é o texto de antes da edição (ou a escrita remota
+ * guardada), não o que o usuário está digitando.
+ */
+const char *line_replica_text(EditorData *editor, int line) {
+    if (editor->edit_text != NULL && line >= editor->editing_line && line < editor->editing_end) {
+        int i = line - editor->editing_line;
+        if (editor->edit_stash != NULL && editor->edit_stash[i] != NULL) return editor->edit_stash[i];
+        return editor->edit_text[i];
+    }
+    return document_line(&editor->doc, line);
+}
+
+/**
+ * Pede a linha inteira a quem a escreveu (no modo otimista, ao home) quando
+ * um delta chega sobre uma base que não é a desta réplica
+ */
+void line_refetch(EditorData *editor, int line, int sender) {
+    Message msg;
+    msg.type = MSG_LINE_REFETCH;
+    msg.line_number = line;
+    msg.sender_rank = editor->rank;
+    msg.args[0] = editor->structure;
+    msg.args[1] = ++editor->refetch_next;
+    g_hash_table_insert(editor->refetches, GINT_TO_POINTER(line), GINT_TO_POINTER(msg.args[1]));
+    comm_send(editor->edit_mode == EDIT_MODE_OPTIMISTIC ? lock_home(editor, line) : sender, &msg);
+}
+
+/**
+ * Libera a faixa em edição e volta a interface ao estado de leitura
+ */
+void editor_release_range(EditorData *editor) {
+    int start = editor->editing_line;
+    int end = editor->editing_end;
+
+    Message msg;
+    msg.type = MSG_RANGE_UNLOCK;
+    msg.line_number = start;
+    msg.sender_rank = editor->rank;
+    msg.args[0] = end;
+    if (comm_send(editor->rank, &msg) == COMM_BACKPRESSURE) {
+        append_log(editor, "Rede congestionada: o commit será entregue em segundo plano");
+    }
+
+    for (int line = start; line < end; line++) {
+        if (line_peek(editor, line)->locked_by == editor->rank) line_set_owner(editor, line, -1);
+    }
+    highlight_range(editor, start, end);
+
+    editor_end_editing(editor);
+}
+
+/**
+ * Volta a interface ao estado sem pedido de bloqueio pendente
+ */
+void editor_request_done(EditorData *editor) {
+    editor->waiting_line = -1;
+    editor->queue_position = 0;
+    editor->structure_op = 0;
+    if (editor->headless) return;
+
+    gtk_widget_set_sensitive(editor->edit_button, TRUE);
+    gtk_widget_set_sensitive(editor->cancel_button, FALSE);
+    gtk_widget_set_sensitive(editor->line_spin, TRUE);
+    gtk_widget_set_sensitive(editor->range_spin, TRUE);
+    update_status(NULL, editor);
+}
+
+/**
+ * Posição atual de uma linha numerada na versão estrutural version
+ * Retorna -1 se a linha foi removida depois, ou se a versão é mais antiga
+ * que o histórico guardado.
+ */
+int structure_transform(EditorData *editor, int version, int line) {
+    if (version < 0 || editor->structure - version > STRUCTURE_HISTORY) return -1;
+
+    for (int v = version; v < editor->structure; v++) {
+        const StructureOp *op = &editor->structure_log[v % STRUCTURE_HISTORY];
+        if (line < op->line) continue;
+        if (op->delta < 0 && line == op->line) return -1;
+        line += op->delta;
+    }
+    return line;
+}
+
+/**
+ * Indica se alguma inserção ou remoção aplicada depois da versão version
+ * alcançou linhas antes de end (na numeração daquela versão)
+ */
+int structure_touches(EditorData *editor, int version, int end) {
+    if (version < 0 || editor->structure - version > STRUCTURE_HISTORY) return TRUE;
+
+    for (int v = version; v < editor->structure; v++) {
+        if (editor->structure_log[v % STRUCTURE_HISTORY].line < end) return TRUE;
+    }
+    return FALSE;
+}
+
+/**
+ * Pede ao rank 0 que ordene a operação estrutural deste usuário
+ * Chamada quando o fim do documento a partir da posição já está bloqueado.
+ */
+void structure_send(EditorData *editor) {
+    Message msg;
+    msg.type = editor->structure_op;
+    msg.line_number = editor->structure_line;
+    msg.sender_rank = editor->rank;
+    msg.content[0] = '\0';
+    msg.args[0] = editor->structure;
+    msg.args[1] = STRUCTURE_REQUEST;
+    msg.args[2] = editor->rank;
+    comm_send(0, &msg);
+}
+
+/**
+ * Desloca o estado por linha depois de uma inserção (delta = 1) ou remoção
+ * (delta = -1) em line, e solta os bloqueios de requester a partir de tail
+ * As cercas das linhas deslocadas são descartadas: a linha pode ter mudado
+ * de home, e tokens só se comparam dentro do mesmo home.
+ */
+void structure_shift_state(EditorData *editor, int line, int delta, int tail, int requester) {
+    GHashTable *shifted = g_hash_table_new(g_direct_hash, g_direct_equal);
+    GHashTableIter iter;
+    gpointer key, value;
+
+    // Pedidos de linha inteira numerados antes da operação: as respostas são descartadas
+    g_hash_table_remove_all(editor->refetches);
+    g_hash_table_remove_all(editor->released_writes);
+    g_hash_table_remove_all(editor->released_before);
+
+    g_hash_table_iter_init(&iter, editor->line_state);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        int l = GPOINTER_TO_INT(key);
+        LineInfo *info = value;
+        if (l < tail) continue;
+
+        if (info->locked_by == requester) {
+            info->locked_by = -1;
+            info->token = 0;
+            info->written = 0;
+        }
+        if (l >= line) {
+            info->fence = 0;
+            g_hash_table_iter_steal(&iter);
+            if ((delta < 0 && l == line) || line_info_is_free(info)) {
+                g_free(info);
+            } else {
+                g_hash_table_insert(shifted, GINT_TO_POINTER(l + delta), info);
+            }
+        } else if (line_info_is_free(info)) {
+            g_hash_table_iter_remove(&iter);
+        }
+    }
+
+    g_hash_table_iter_init(&iter, shifted);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        g_hash_table_insert(editor->line_state, key, value);
+    }
+    g_hash_table_destroy(shifted);
+}
+
+/**
+ * Aplica uma inserção ou remoção de linha ordenada pelo rank 0
+ * O solicitante bloqueou o fim do documento a partir da posição, então
+ * nenhuma outra faixa bloqueada muda de número; esses bloqueios terminam
+ * com a operação, em todos os ranks, sem MSG_LINE_LOCK_OWNER.
+ */
+void structure_apply(EditorData *editor, const Message *msg) {
+    int line = msg->line_number;
+    int delta = msg->type == MSG_LINE_INSERT ? 1 : -1;
+    int requester = msg->args[2];
+    int count = document_line_count(&editor->doc);
+    int tail = line < count ? line : count - 1;
+
+    if (msg->args[0] != editor->structure) return;
+    if (line < 0 || (delta > 0 ? line > count : line >= count)) return;
+
+    editor->p_update = TRUE;
+    if (delta > 0) {
+        document_insert_line(&editor->doc, line, msg->content);
+        journal_append(editor->journal, JOURNAL_INSERT, line, msg->content);
+        view_insert_line(editor, line, msg->content);
+    } else {
+        document_delete_line(&editor->doc, line);
+        journal_append(editor->journal, JOURNAL_DELETE, line, NULL);
+        view_delete_line(editor, line);
+    }
+    editor->p_update = FALSE;
+
+    structure_shift_state(editor, line, delta, tail, requester);
+    editor->structure_log[editor->structure % STRUCTURE_HISTORY].line = line;
+    editor->structure_log[editor->structure % STRUCTURE_HISTORY].delta = delta;
+    editor->structure++;
+
+    char log_msg[256];
+    sprintf(log_msg, delta > 0 ? "%s inseriu a linha %d" : "%s removeu a linha %d",
+            user_name(editor, requester), line + 1);
+    append_log(editor, log_msg);
+
+    if (requester == editor->rank && editor->structure_op != 0) {
+        editor->structure_op = 0;
+        editor_end_editing(editor);
+    }
+    if (editor->headless) return;
+
+    count = document_line_count(&editor->doc);
+    gtk_spin_button_set_range(GTK_SPIN_BUTTON(editor->line_spin), 1, count);
+    gtk_spin_button_set_range(GTK_SPIN_BUTTON(editor->range_spin), 1, count);
+    highlight_range(editor, tail, count);
+    update_status(NULL, editor);
+}
+
+/**
+ * Prepara a faixa deste rank para a exportação ordenada pelo rank 0
+ * Todos os ranks chegam aqui na mesma versão estrutural, então dividem o
+ * mesmo número de linhas; cada um copia as suas da própria réplica e o
+ * motor as grava com MPI-IO.
+ */
+void export_start(EditorData *editor, const Message *msg) {
+    ExportJob *job = g_new0(ExportJob, 1);
+    int count = document_line_count(&editor->doc);
+    int first = (long long)count * editor->rank / editor->size;
+    int last = (long long)count * (editor->rank + 1) / editor->size;
+    GString *stripe = g_string_sized_new((last - first) * 32 + 1);
+
+    for (int i = first; i < last; i++) {
+        g_string_append(stripe, document_line(&editor->doc, i));
+        g_string_append_c(stripe, '\n');
+    }
+    snprintf(job->path, sizeof(job->path), "%s", msg->content);
+    job->lines = count;
+    job->len = stripe->len;
+    job->data = g_string_free(stripe, FALSE);
+
+    if (msg->args[2] != editor->rank) editor->exports++;
+
+    pthread_mutex_lock(&export_mutex);
+    g_queue_push_tail(&export_jobs, job);
+    pthread_mutex_unlock(&export_mutex);
+    atomic_fetch_add(&export_queued, 1);
+    engine_wake();
+}
+
+/**
+ * Registra o resultado de uma exportação gravada pelo motor
+ */
+void export_finish(EditorData *editor, const Message *msg) {
+    char log_msg[MAX_LINE_LENGTH + 128];
+
+    if (msg->args[1] == MPI_SUCCESS) {
+        snprintf(log_msg, sizeof(log_msg), "Documento exportado com MPI-IO para %s: %d linhas, %d KiB em %d ms",
+                 msg->content, msg->line_number, msg->args[3], msg->args[2]);
+    } else {
+        snprintf(log_msg, sizeof(log_msg), "Exportação MPI-IO falhou: %s", msg->content);
+    }
+    append_log(editor, log_msg);
+    if (editor->exports > 0) editor->exports--;
+}
+
+/**
+ * Doador: envia ao requester o documento e o estado das linhas, em pedaços
+ * O snapshot é copiado de uma vez (update_mutex já travado) e sai em
+ * quadros de até COMM_RECV_BUF_SIZE; o pool do motor mantém vários deles
+ * em voo, então a transferência anda na velocidade da rede e não de uma
+ * mensagem por linha. Formato: versão estrutural, número de entradas de
+ * line_state, structure_log, as entradas (linha + LineInfo) e o texto.
+ */
+void sync_send_snapshot(EditorData *editor, int requester) {
+    GString *snapshot = g_string_sized_new(JOURNAL_BUFFER_SIZE);
+    int header[2] = {editor->structure, (int)g_hash_table_size(editor->line_state)};
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_string_append_len(snapshot, (const char *)header, sizeof(header));
+    g_string_append_len(snapshot, (const char *)editor->structure_log, sizeof(editor->structure_log));
+    g_hash_table_iter_init(&iter, editor->line_state);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        int line = GPOINTER_TO_INT(key);
+        g_string_append_len(snapshot, (const char *)&line, sizeof(int));
+        g_string_append_len(snapshot, (const char *)value, sizeof(LineInfo));
+    }
+    doc_append(editor->doc.root, snapshot);
+
+    int chunks = (snapshot->len + SYNC_CHUNK_BYTES - 1) / SYNC_CHUNK_BYTES;
+    char *payload = g_malloc(2 * sizeof(int) + SYNC_CHUNK_BYTES);
+    for (int i = 0; i < chunks; i++) {
+        int offset = i * SYNC_CHUNK_BYTES;
+        int n = (int)snapshot->len - offset < SYNC_CHUNK_BYTES ? (int)snapshot->len - offset : SYNC_CHUNK_BYTES;
+        WireHeader frame;
+        frame.type = MSG_SYNC_DATA;
+        frame.line_number = snapshot->len;
+        frame.sender_rank = editor->rank;
+        frame.length = 2 * sizeof(int) + n;
+        memcpy(payload, &i, sizeof(int));
+        memcpy(payload + sizeof(int), &chunks, sizeof(int));
+        memcpy(payload + 2 * sizeof(int), snapshot->str + offset, n);
+        comm_send_frame(requester, &frame, payload);
+    }
+    g_free(payload);
+
+    char log_msg[256];
+    snprintf(log_msg, sizeof(log_msg), "Enviando o documento a %s (%d KiB em %d pedaços)",
+             user_name(editor, requester), (int)(snapshot->len / 1024), chunks);
+    append_log(editor, log_msg);
+    g_string_free(snapshot, TRUE);
+}
+
+/**
+ * Processa atualizações da interface baseadas em mensagens MPI
+ * Chamada na thread da interface, com update_mutex já travado.
+ */
+void update_interface(EditorData *editor, const Message *msg) {
+    switch (msg->type) {
+        case MSG_LINE_UPDATE: {
+            // Escrita numerada antes de inserções ou remoções de linhas: segue a linha
+            int line = structure_transform(editor, msg->args[2], msg->line_number);
+            if (line < 0) {
+                char removed_msg[256];
+                sprintf(removed_msg, "Atualização de %s descartada: a linha %d foi removida",
+                        user_name(editor, msg->sender_rank), msg->line_number + 1);
+                append_log(editor, removed_msg);
+                break;
+            }
+            if (update_is_fenced(editor, line, msg->args[0])) {
+                char fenced_msg[256];
+                sprintf(fenced_msg, "Atualização atrasada de %s na linha %d descartada (bloqueio expirado)",
+                        user_name(editor, msg->sender_rank), line + 1);
+                append_log(editor, fenced_msg);
+                break;
+            }
+            if (msg->args[1] > 0 &&
+                optimistic_receive(editor, line, msg->args[1], msg->content, msg->sender_rank)) {
+                break;
+            }
+            editor->p_update = TRUE;
+            editor_set_line(editor, line, msg->content);
+            // Os tokens do home crescem a cada concessão: uma escrita sob um mais
+            // antigo que chegue depois desta é de um dono anterior
+            line_mark_written(editor, line, msg->args[0]);
+            if (editor->edit_mode == EDIT_MODE_CRDT) {
+                crdt_line_reset(editor, line);
+                crdt_retry_pending(editor);
+            }
+            
+            char update_msg[256];
+            sprintf(update_msg, "%s atualizou linha %d", user_name(editor, msg->sender_rank), line + 1);
             append_log(editor, update_msg);
             editor->p_update = FALSE;
             break;
+        }
+
+        case MSG_LINE_DELTA: {
+            // Reconstrói a linha sobre a base que o autor tinha e segue como escrita inteira
+            Message full = *msg;
+            full.type = MSG_LINE_UPDATE;
+            int line = structure_transform(editor, msg->args[2], msg->line_number);
+            if (line >= 0 && !update_is_fenced(editor, line, msg->args[0])) {
+                const char *base = line_replica_text(editor, line);
+                if (msg->sender_rank == editor->rank && line_checksum(base) != msg->args[3]) {
+                    // Eco do próprio commit otimista sem interface: a linha já tem o texto enviado
+                    strncpy(full.content, base, MAX_LINE_LENGTH - 1);
+                    full.content[MAX_LINE_LENGTH - 1] = '\0';
+                } else if (line_checksum(base) != msg->args[3] ||
+                           !line_delta_apply(base, msg->args[4], msg->args[5], msg->content,
+                                             strlen(msg->content), full.content)) {
+                    char delta_msg[256];
+                    sprintf(delta_msg, "Atualização de %s na linha %d sobre outra versão: pedindo a linha inteira",
+                            user_name(editor, msg->sender_rank), line + 1);
+                    append_log(editor, delta_msg);
+                    line_refetch(editor, line, msg->sender_rank);
+                    break;
+                }
+            }
+            update_interface(editor, &full);
+            break;
+        }
+
+        case MSG_LINE_REFETCH: {
+            // Outro rank não tinha a base de um delta: responde com a linha inteira
+            int line = structure_transform(editor, msg->args[0], msg->line_number);
+            if (line < 0 || line >= document_line_count(&editor->doc)) break;
+
+            Message reply;
+            reply.type = MSG_LINE_REFETCH_REPLY;
+            reply.line_number = line;
+            reply.sender_rank = editor->rank;
+            reply.args[0] = line_peek(editor, line)->token;
+            reply.args[1] = line_peek(editor, line)->version;
+            reply.args[2] = editor->structure;
+            reply.args[3] = msg->args[1];
+            strncpy(reply.content, line_replica_text(editor, line), MAX_LINE_LENGTH - 1);
+            reply.content[MAX_LINE_LENGTH - 1] = '\0';
+            comm_send(msg->sender_rank, &reply);
+            break;
+        }
+
+        case MSG_LINE_REFETCH_REPLY: {
+            // O token da resposta é o da concessão atual, não o da escrita que
+            // produziu o texto: só vale se a linha não foi escrita desde o pedido
+            int line = structure_transform(editor, msg->args[2], msg->line_number);
+            if (line < 0 || GPOINTER_TO_INT(g_hash_table_lookup(editor->refetches,
+                                                                GINT_TO_POINTER(line))) != msg->args[3]) {
+                break;
+            }
+            g_hash_table_remove(editor->refetches, GINT_TO_POINTER(line));
+            Message full = *msg;
+            full.type = MSG_LINE_UPDATE;
+            update_interface(editor, &full);
+            break;
+        }
+
+        case MSG_LINE_LOCK_GRANTED:
+            editor->waiting_line = -1;
+            editor->queue_position = 0;
+            if (!editor->headless) gtk_widget_set_sensitive(editor->cancel_button, FALSE);
+            for (int line = msg->line_number; line < msg->args[0]; line++) {
+                line_set_owner(editor, line, editor->rank);
+            }
+            if (editor->structure_op != 0) {
+                // Fim do documento bloqueado: falta o rank 0 ordenar a operação
+                editor->editing_line = msg->line_number;
+                editor->editing_end = msg->args[0];
+                structure_send(editor);
+                break;
+            }
+            editor_begin_editing(editor, msg->line_number, msg->args[0]);
+            break;
+
+        case MSG_LINE_LOCK_DENIED:
+            char denied_range[64];
+            char denied_msg[256];
+            describe_range(denied_range, sizeof(denied_range), msg->line_number, msg->args[0]);
+            if (msg->sender_rank < 0) {
+                sprintf(denied_msg, "Não foi possível bloquear %s: linhas foram inseridas ou removidas",
+                        denied_range);
+            } else {
+                sprintf(denied_msg, "Não foi possível bloquear %s: %s está editando parte dela",
+                        denied_range, user_name(editor, msg->sender_rank));
+            }
+            append_log(editor, denied_msg);
+            editor_request_done(editor);
+            break;
+
+        case MSG_LINE_LOCK_QUEUED: {
+            // O home pôs o pedido na fila; a concessão chega sozinha
+            int first = editor->queue_position == 0;
+            editor->queue_position = msg->args[2];
+            if (first) {
+                char queued_range[64];
+                char queued_msg[256];
+                describe_range(queued_range, sizeof(queued_range), msg->line_number, msg->args[0]);
+                sprintf(queued_msg, "%s ocupada por %s: aguardando na fila (posição %d)",
+                        queued_range, user_name(editor, msg->sender_rank), msg->args[2]);
+                append_log(editor, queued_msg);
+            }
+            update_status(NULL, editor);
+            break;
+        }
+
+        case MSG_RANGE_CANCEL: {
+            char cancel_range[64];
+            char cancel_msg[256];
+            describe_range(cancel_range, sizeof(cancel_range), msg->line_number, msg->args[0]);
+            sprintf(cancel_msg, msg->args[1] ? "Pedido da %s expirou na fila" : "Pedido da %s cancelado",
+                    cancel_range);
+            append_log(editor, cancel_msg);
+            editor_request_done(editor);
+            break;
+        }
+
+        case MSG_LINE_LOCK_OWNER: {
+            // Mudança de dono anunciada pelo home da faixa
+            int start = msg->line_number;
+            int end = msg->args[1];
+            int owner = msg->args[0];
+            int token = msg->args[2];
+            int revoked = msg->args[3];
+            // Uma inserção ou remoção a partir daqui já encerrou essa concessão
+            if (structure_touches(editor, msg->args[4], end)) break;
+            if (start < 0 || end > document_line_count(&editor->doc) || start >= end) break;
+            int previous = line_peek(editor, start)->locked_by;
+
+            for (int line = start; line < end && (owner >= 0 || revoked); line++) {
+                LineInfo *info = line_info(editor, line);
+                if (owner >= 0) info->token = token;
+                if (revoked && token > info->fence) info->fence = token;
+            }
+            if (owner == previous) break;
+
+            char owner_range[64];
+            char owner_msg[256];
+            describe_range(owner_range, sizeof(owner_range), start, end);
+            if (owner >= 0) {
+                sprintf(owner_msg, "%s começou a editar %s", user_name(editor, owner), owner_range);
+            } else if (revoked) {
+                sprintf(owner_msg, "Bloqueio de %s sobre %s expirou sem renovação",
+                        user_name(editor, previous), owner_range);
+            } else {
+                sprintf(owner_msg, "%s liberou %s", user_name(editor, previous), owner_range);
+            }
+            for (int line = start; line < end; line++) {
+                line_set_owner(editor, line, owner);
+            }
+            append_log(editor, owner_msg);
+
+            // O home recolheu parte da faixa deste usuário: a edição não vale mais
+            if (revoked && previous == editor->rank && editor->editing_line >= 0 &&
+                start < editor->editing_end && editor->editing_line < end) {
+                append_log(editor, "Sua edição foi descartada: o bloqueio expirou");
+                editor_release_range(editor);
+            }
+
+            highlight_range(editor, start, end);
+            update_status(NULL, editor);
+            break;
+        }
+
+        case MSG_CRDT_INSERT:
+        case MSG_CRDT_DELETE:
+            if (editor->edit_mode == EDIT_MODE_CRDT) crdt_receive(editor, msg);
+            break;
+
+        case MSG_LINE_INSERT:
+        case MSG_LINE_DELETE:
+            if (msg->args[1] == STRUCTURE_APPLY) {
+                structure_apply(editor, msg);
+                break;
+            }
+            // Recusada pelo rank 0: o pedido foi numerado antes de outra operação
+            if (editor->structure_op == 0 || editor->editing_line < 0) break;
+            append_log(editor, "Inserção ou remoção de linha recusada: o documento mudou, tente de novo");
+            editor->structure_op = 0;
+            editor_release_range(editor);
+            break;
+
+        case MSG_SYNC_REQUEST:
+            if (msg->sender_rank >= 0 && msg->sender_rank < editor->size && msg->sender_rank != editor->rank) {
+                sync_send_snapshot(editor, msg->sender_rank);
+            }
+            break;
+
+        case MSG_EXPORT:
+            if (msg->args[0] == EXPORT_APPLY) {
+                export_start(editor, msg);
+            } else if (msg->args[0] == EXPORT_DONE) {
+                export_finish(editor, msg);
+            }
+            break;
+
+        case MSG_LINE_CONFLICT:
+            char conflict_msg[MAX_LINE_LENGTH + 128];
+            if (msg->args[1]) {
+                // Commit por delta: o home só devolve o trecho
+                sprintf(conflict_msg, "Conflito na linha %d: outra versão foi aceita antes e a sua foi descartada",
+                        msg->line_number + 1);
+            } else {
+                sprintf(conflict_msg, "Conflito na linha %d: outra versão foi aceita antes e a sua foi descartada: %s",
+                        msg->line_number + 1, msg->content);
+            }
+            append_log(editor, conflict_msg);
+            break;
+
+        case MSG_CHAT:
+            append_chat(editor, user_name(editor, msg->sender_rank), msg->content);
+            break;
+
+        case MSG_RANK_LEAVE:
+            char leave_msg[256];
+            sprintf(leave_msg, "%s saiu da sessão", user_name(editor, msg->sender_rank));
+            append_log(editor, leave_msg);
+            break;
+
+        case MSG_LOG_ENTRY:
+            append_log(editor, msg->content);
+            break;
+    }
+}
+
+/**
+ * Aplica os registros de um MSG_LINE_UPDATE_BATCH em uma única passada
+ * Chamada na thread da interface, com update_mutex já travado.
+ */
+void apply_line_batch(EditorData *editor, const Message *msg, const char *records, int len) {
+    char text[MAX_LINE_LENGTH];
+    int offset = 0;
+    int applied = 0;
+    int fenced = 0;
+    int removed = 0;
+    int refetched = 0;
+
+    editor->p_update = TRUE;
+    for (int i = 0; i < msg->line_number; i++) {
+        int line, length;
+        int delta[3];
+        if (offset + 2 * (int)sizeof(int) > len) break;
+        memcpy(&line, records + offset, sizeof(int));
+        memcpy(&length, records + offset + sizeof(int), sizeof(int));
+        offset += 2 * sizeof(int);
+        int is_delta = length < 0;
+        if (is_delta) {
+            if (offset + DELTA_OVERHEAD > len) break;
+            memcpy(delta, records + offset, DELTA_OVERHEAD);
+            offset += DELTA_OVERHEAD;
+            length = -1 - length;
+        }
+        if (offset + length > len) break;
+
+        // Lote numerado antes de inserções ou remoções de linhas: segue cada linha
+        line = structure_transform(editor, msg->args[1], line);
+        if (line < 0) {
+            removed++;
+        } else if (update_is_fenced(editor, line, msg->args[0])) {
+            fenced += line < document_line_count(&editor->doc);
+        } else if (is_delta && (line_checksum(line_replica_text(editor, line)) != delta[0] ||
+                                !line_delta_apply(line_replica_text(editor, line), delta[1], delta[2],
+                                                  records + offset, length, text))) {
+            // Base diferente da do autor: a linha inteira vem em separado
+            line_refetch(editor, line, msg->sender_rank);
+            refetched++;
+        } else {
+            if (!is_delta) {
+                int n = length < MAX_LINE_LENGTH - 1 ? length : MAX_LINE_LENGTH - 1;
+                memcpy(text, records + offset, n);
+                text[n] = '\0';
+            }
+            // No modo otimista todo lote vem do home da linha: uma versão por registro
+            if (editor->edit_mode != EDIT_MODE_OPTIMISTIC ||
+                !optimistic_receive(editor, line, line_peek(editor, line)->version + 1, text,
+                                    msg->sender_rank)) {
+                editor_set_line(editor, line, text);
+                line_mark_written(editor, line, msg->args[0]);
+                if (editor->edit_mode == EDIT_MODE_CRDT) crdt_line_reset(editor, line);
+                applied++;
+            }
+        }
+        offset += length;
+    }
+    editor->p_update = FALSE;
+    if (editor->edit_mode == EDIT_MODE_CRDT) crdt_retry_pending(editor);
+
+    char log_msg[256];
+    sprintf(log_msg, "%s atualizou %d linhas em lote", user_name(editor, msg->sender_rank), applied);
+    append_log(editor, log_msg);
+    if (fenced > 0) {
+        sprintf(log_msg, "%d linhas atrasadas de %s descartadas (bloqueio expirado)", fenced,
+                user_name(editor, msg->sender_rank));
+        append_log(editor, log_msg);
+    }
+    if (removed > 0) {
+        sprintf(log_msg, "%d linhas de %s descartadas: foram removidas", removed,
+                user_name(editor, msg->sender_rank));
+        append_log(editor, log_msg);
+    }
+    if (refetched > 0) {
+        sprintf(log_msg, "%d linhas de %s sobre outra versão: pedindo as linhas inteiras", refetched,
+                user_name(editor, msg->sender_rank));
+        append_log(editor, log_msg);
+    }
+}
+
+/**
+ * Acrescenta uma latência (µs) a um vetor que cresce sob demanda
+ */
+void bench_push(int **values, int *count, int *cap, int value) {
+    if (*count == *cap) {
+        *cap = *cap ? *cap * 2 : 256;
+        *values = g_realloc(*values, *cap * sizeof(int));
+    }
+    (*values)[(*count)++] = value;
+}
+
+/**
+ * Registra no benchmark uma mensagem entregue à thread da interface
+ * Só anota o evento e o instante; as ações ficam com bench_tick.
+ */
+void bench_observe(BenchRun *run, const Message *msg) {
+    EditorData *editor = run->editor;
+
+    switch (msg->type) {
+        case MSG_LINE_LOCK_GRANTED:
+            run->outcome = 1;
+            run->event_at = g_get_monotonic_time();
+            break;
+
+        case MSG_LINE_LOCK_DENIED:
+        case MSG_RANGE_CANCEL:
+            run->outcome = -1;
+            break;
+
+        case MSG_LINE_UPDATE:
+            if (msg->line_number != document_line_count(&editor->doc) - 1 || msg->sender_rank != 0 ||
+                editor->rank == 0) {
+                break;
+            }
+            run->updates++;
+
+            Message echo;
+            echo.type = MSG_BENCH;
+            echo.line_number = 0;
+            echo.sender_rank = editor->rank;
+            echo.args[0] = BENCH_OP_ECHO;
+            echo.args[1] = run->step;
+            echo.args[2] = 0;
+            echo.args[3] = 0;
+            comm_send(0, &echo);
+            break;
+
+        case MSG_CHAT:
+            run->chats++;
+            break;
+
+        case MSG_LINE_UPDATE_BATCH:
+            run->records += msg->line_number;
+            break;
+
+        case MSG_BENCH:
+            if (msg->args[0] == BENCH_OP_START) {
+                run->next_step = msg->args[1];
+            } else if (msg->args[0] == BENCH_OP_ECHO && editor->rank == 0) {
+                if (++run->echoes == editor->size - 1) run->event_at = g_get_monotonic_time();
+            } else if (msg->args[0] == BENCH_OP_SENT) {
+                run->expect_records = msg->args[2];
+            }
+            break;
+    }
+}
+
+/**
+ * Rank 0: junta as latências relatadas por um rank para o passo atual
+ */
+void bench_on_report(BenchRun *run, const Message *msg, const char *payload, int len) {
+    if (run->editor->rank != 0 || msg->args[0] != run->step) return;
+
+    int count = len / (int)sizeof(int);
+    for (int i = 0; i < count; i++) {
+        int value;
+        memcpy(&value, payload + i * sizeof(int), sizeof(int));
+        bench_push(&run->merged, &run->nmerged, &run->merged_cap, value);
+    }
+    run->reports++;
+}
+
+/**
+ * Inicia um lote de atualizações: uma única ação de usuário no buffer,
+ * rolagem e status adiados para o final
+ */
+void ui_batch_begin(EditorData *editor) {
+    editor->batching = TRUE;
+    editor->log_dirty = FALSE;
+    editor->chat_dirty = FALSE;
+    editor->status_dirty = FALSE;
+    if (!editor->headless) gtk_text_buffer_begin_user_action(editor->text_buffer);
+}
+
+/**
+ * Encerra o lote: uma rolagem por painel e um único recálculo de status
+ */
+void ui_batch_end(EditorData *editor) {
+    if (!editor->headless) gtk_text_buffer_end_user_action(editor->text_buffer);
+    editor->batching = FALSE;
+
+    if (editor->log_dirty) {
+        GtkTextMark *mark = gtk_text_buffer_get_insert(editor->log_buffer);
+        gtk_text_view_scroll_mark_onscreen(GTK_TEXT_VIEW(editor->log_view), mark);
+    }
+    if (editor->chat_dirty) {
+        GtkTextMark *mark = gtk_text_buffer_get_insert(editor->chat_buffer);
+        gtk_text_view_scroll_mark_onscreen(GTK_TEXT_VIEW(editor->chat_view), mark);
+    }
+    if (editor->status_dirty) {
+        update_status(NULL, editor);
+    }
+}
+
+/**
+ * Envia uma MSG_MERKLE com a numeração local e os registros dados
+ */
+void merkle_send(EditorData *editor, int dest, int stage, int round, const char *records, int len) {
+    int args[4] = {stage, editor->structure, document_line_count(&editor->doc), round};
+    char *payload = g_malloc(sizeof(args) + len);
+    WireHeader header;
+
+    memcpy(payload, args, sizeof(args));
+    if (len > 0) memcpy(payload + sizeof(args), records, len);
+    header.type = MSG_MERKLE;
+    header.line_number = 0;
+    header.sender_rank = editor->rank;
+    header.length = sizeof(args) + len;
+    comm_send_frame(dest, &header, payload);
+    g_free(payload);
+}
+
+/**
+ * Rank 0: responde a uma consulta da anti-entropia
+ * MERKLE_QUERY recebe os hashes dos nós pedidos; MERKLE_BLOCK, o conteúdo
+ * e a versão das linhas dos blocos cujo hash difere do enviado (menos as
+ * bloqueadas ou em edição aqui, que ainda podem mudar). Uma resposta por
+ * pedido, vazia se a numeração do solicitante não é a daqui.
+ */
+void merkle_answer(EditorData *editor, const Message *msg, const char *records, int len) {
+    GString *reply = g_string_sized_new(1024);
+    int count = document_line_count(&editor->doc);
+    int entry = sizeof(int) + MERKLE_BLOCK_LINES * sizeof(guint64);
+
+    if (msg->args[1] == editor->structure && msg->args[2] == count) {
+        MerkleTree *tree = &editor->doc.merkle;
+        merkle_refresh(&editor->doc);
+
+        if (msg->args[0] == MERKLE_QUERY) {
+            for (int offset = 0; offset + (int)sizeof(int) <= len; offset += sizeof(int)) {
+                int node;
+                memcpy(&node, records + offset, sizeof(int));
+                if (node < 1 || node >= 2 * tree->leaves) continue;
+                g_string_append_len(reply, (const char *)&node, sizeof(int));
+                g_string_append_len(reply, (const char *)&tree->nodes[node], sizeof(guint64));
+            }
+        } else {
+            for (int offset = 0; offset + entry <= len; offset += entry) {
+                int block;
+                memcpy(&block, records + offset, sizeof(int));
+                for (int k = 0; k < MERKLE_BLOCK_LINES; k++) {
+                    int line = block * MERKLE_BLOCK_LINES + k;
+                    guint64 theirs;
+                    if (line < 0 || line >= count) break;
+                    memcpy(&theirs, records + offset + sizeof(int) + k * sizeof(guint64), sizeof(guint64));
+
+                    const char *text = document_line(&editor->doc, line);
+                    if (merkle_line_hash(text) == theirs || line_peek(editor, line)->locked_by >= 0 ||
+                        (line >= editor->editing_line && line < editor->editing_end)) {
+                        continue;
+                    }
+                    int n = strlen(text);
+                    g_string_append_len(reply, (const char *)&line, sizeof(int));
+                    g_string_append_len(reply, (const char *)&line_peek(editor, line)->version, sizeof(int));
+                    g_string_append_len(reply, (const char *)&n, sizeof(int));
+                    g_string_append_len(reply, text, n);
+                }
+            }
+        }
+    }
+
+    merkle_send(editor, msg->sender_rank, msg->args[0] == MERKLE_QUERY ? MERKLE_HASHES : MERKLE_LINES,
+                msg->args[3], reply->str, reply->len);
+    g_string_free(reply, TRUE);
+}
+
+/**
+ * Encerra a rodada: os blocos divergentes dela viram os suspeitos da próxima
+ */
+void merkle_end_round(EditorData *editor) {
+    GHashTable *suspects = editor->merkle_suspects;
+
+    editor->merkle_suspects = editor->merkle_seen;
+    editor->merkle_seen = suspects;
+    g_hash_table_remove_all(editor->merkle_seen);
+    editor->merkle_active = FALSE;
+
+    if (editor->merkle_repaired > 0) {
+        char log_msg[256];
+        snprintf(log_msg, sizeof(log_msg), "Réplica divergente de %s: %d linhas reparadas",
+                 user_name(editor, 0), editor->merkle_repaired);
+        append_log(editor, log_msg);
+    }
+}
+
+/**
+ * Compara com os hashes recebidos do rank 0 e desce só pelos nós que diferem
+ * Um bloco só é pedido se divergiu com os mesmos hashes dos dois lados
+ * também na rodada anterior: diferenças de atualizações ainda em trânsito
+ * somem sozinhas e não são "reparadas" para trás.
+ */
+void merkle_compare(EditorData *editor, const Message *msg, const char *records, int len) {
+    if (!editor->merkle_active || msg->args[3] != editor->merkle_rounds) return;
+    editor->merkle_outstanding--;
+
+    int count = document_line_count(&editor->doc);
+    if (msg->args[1] != editor->structure || msg->args[2] != count) {
+        // Numerações diferentes (operação estrutural em trânsito): fica para a próxima rodada
+        g_hash_table_remove_all(editor->merkle_seen);
+        editor->merkle_active = FALSE;
+        return;
+    }
+
+    merkle_refresh(&editor->doc);
+    MerkleTree *tree = &editor->doc.merkle;
+
+    if (msg->args[0] == MERKLE_HASHES) {
+        GString *query = g_string_sized_new(256);
+        GString *blocks = g_string_sized_new(1024);
+        int nblocks = 0;
+
+        for (int offset = 0; offset + (int)(sizeof(int) + sizeof(guint64)) <= len;
+             offset += sizeof(int) + sizeof(guint64)) {
+            int node;
+            guint64 theirs;
+            memcpy(&node, records + offset, sizeof(int));
+            memcpy(&theirs, records + offset + sizeof(int), sizeof(guint64));
+            if (node < 1 || node >= 2 * tree->leaves || tree->nodes[node] == theirs) continue;
+
+            if (node < tree->leaves) {
+                int children[2] = {2 * node, 2 * node + 1};
+                g_string_append_len(query, (const char *)children, sizeof(children));
+                if (query->len / sizeof(int) >= MERKLE_MAX_NODES) {
+                    merkle_send(editor, 0, MERKLE_QUERY, editor->merkle_rounds, query->str, query->len);
+                    editor->merkle_outstanding++;
+                    g_string_truncate(query, 0);
+                }
+                continue;
+            }
+
+            int block = node - tree->leaves;
+            guint64 *pair = g_new(guint64, 2);
+            pair[0] = tree->nodes[node];
+            pair[1] = theirs;
+            guint64 *before = g_hash_table_lookup(editor->merkle_suspects, GINT_TO_POINTER(block));
+            gboolean stable = before != NULL && before[0] == pair[0] && before[1] == pair[1];
+            g_hash_table_insert(editor->merkle_seen, GINT_TO_POINTER(block), pair);
+            if (!stable) continue;
+
+            g_string_append_len(blocks, (const char *)&block, sizeof(int));
+            for (int k = 0; k < MERKLE_BLOCK_LINES; k++) {
+                int line = block * MERKLE_BLOCK_LINES + k;
+                guint64 hash = line < count ? merkle_line_hash(document_line(&editor->doc, line)) : 0;
+                g_string_append_len(blocks, (const char *)&hash, sizeof(guint64));
+            }
+            if (++nblocks == MERKLE_MAX_BLOCKS) {
+                merkle_send(editor, 0, MERKLE_BLOCK, editor->merkle_rounds, blocks->str, blocks->len);
+                editor->merkle_outstanding++;
+                g_string_truncate(blocks, 0);
+                nblocks = 0;
+            }
+        }
+        if (query->len > 0) {
+            merkle_send(editor, 0, MERKLE_QUERY, editor->merkle_rounds, query->str, query->len);
+            editor->merkle_outstanding++;
+        }
+        if (nblocks > 0) {
+            merkle_send(editor, 0, MERKLE_BLOCK, editor->merkle_rounds, blocks->str, blocks->len);
+            editor->merkle_outstanding++;
+        }
+        g_string_free(query, TRUE);
+        g_string_free(blocks, TRUE);
+    } else {
+        char text[MAX_LINE_LENGTH];
+        int offset = 0;
+
+        editor->p_update = TRUE;
+        while (offset + 3 * (int)sizeof(int) <= len) {
+            int line, version, n;
+            memcpy(&line, records + offset, sizeof(int));
+            memcpy(&version, records + offset + sizeof(int), sizeof(int));
+            memcpy(&n, records + offset + 2 * sizeof(int), sizeof(int));
+            offset += 3 * sizeof(int);
+            if (n < 0 || n > len - offset) break;
+
+            int copy = n < MAX_LINE_LENGTH - 1 ? n : MAX_LINE_LENGTH - 1;
+            memcpy(text, records + offset, copy);
+            text[copy] = '\0';
+            offset += n;
+            // Linha em edição aqui (no modo otimista, sem bloqueio): o commit decide
+            if (line < 0 || line >= count || line_peek(editor, line)->locked_by >= 0 ||
+                (line >= editor->editing_line && line < editor->editing_end)) {
+                continue;
+            }
+            if (strcmp(document_line(&editor->doc, line), text) == 0) continue;
+            editor_set_line(editor, line, text);
+            // O próximo commit otimista da linha parte da versão do texto reparado
+            if (version != line_peek(editor, line)->version) line_info(editor, line)->version = version;
+            editor->merkle_repaired++;
+        }
+        editor->p_update = FALSE;
+    }
+
+    if (editor->merkle_outstanding == 0) merkle_end_round(editor);
+}
+
+/**
+ * Aplica uma mensagem recebida e libera seus registros
+ */
+void ui_slot_apply(EditorData *editor, UiSlot *slot) {
+    if (slot->msg.type == MSG_MERKLE) {
+        if (slot->msg.args[0] == MERKLE_QUERY || slot->msg.args[0] == MERKLE_BLOCK) {
+            if (editor->rank == 0) merkle_answer(editor, &slot->msg, slot->payload, slot->payload_len);
+        } else {
+            merkle_compare(editor, &slot->msg, slot->payload, slot->payload_len);
+        }
+    } else if (slot->payload && slot->msg.type == MSG_CRDT_ACK) {
+        crdt_on_ack(editor, &slot->msg, slot->payload, slot->payload_len);
+    } else if (slot->payload && slot->msg.type == MSG_BENCH_REPORT) {
+        if (g_bench != NULL) bench_on_report(g_bench, &slot->msg, slot->payload, slot->payload_len);
+    } else if (slot->payload) {
+        apply_line_batch(editor, &slot->msg, slot->payload, slot->payload_len);
+    } else {
+        update_interface(editor, &slot->msg);
+    }
+    g_free(slot->payload);
+    slot->payload = NULL;
+    if (g_bench != NULL) bench_observe(g_bench, &slot->msg);
+}
+
+/**
+ * Versão estrutural da numeração de uma mensagem, ou -1 se ela não numera linhas
+ */
+int message_structure(const Message *msg) {
+    switch (msg->type) {
+        case MSG_LINE_UPDATE:
+        case MSG_LINE_DELTA:
+        case MSG_LINE_REFETCH_REPLY:
+            return msg->args[2];
+        case MSG_LINE_REFETCH:
+            return msg->args[0];
+        case MSG_LINE_UPDATE_BATCH:
+            return msg->args[1];
+        case MSG_LINE_LOCK_OWNER:
+            return msg->args[4];
+        case MSG_EXPORT:
+            return msg->args[0] == EXPORT_APPLY ? msg->args[1] : -1;
+        default:
+            return -1;
+    }
+}
+
+/**
+ * Aplica as mensagens adiadas cuja numeração este rank já alcançou
+ */
+void structure_retry_pending(EditorData *editor) {
+    GList *node = editor->structure_pending.head;
+
+    while (node != NULL) {
+        GList *next = node->next;
+        UiSlot *slot = node->data;
+        if (message_structure(&slot->msg) <= editor->structure) {
+            g_queue_delete_link(&editor->structure_pending, node);
+            ui_slot_apply(editor, slot);
+            g_free(slot);
+        }
+        node = next;
+    }
+}
+
+/**
+ * Guarda em queue uma cópia do slot, que fica com os registros
+ */
+void ui_slot_defer(GQueue *queue, UiSlot *slot) {
+    UiSlot *deferred = g_new(UiSlot, 1);
+    *deferred = *slot;
+    slot->payload = NULL;
+    g_queue_push_tail(queue, deferred);
+}
+
+/**
+ * Troca a réplica local pelo snapshot recebido e reaplica, em ordem, o que
+ * chegou durante a transferência
+ * Retorna 0 se o snapshot está malformado (a réplica fica como estava).
+ */
+int sync_install(EditorData *editor) {
+    const char *data = editor->sync_data;
+    int len = editor->sync_len;
+    int header[2];
+    int fixed = sizeof(header) + sizeof(editor->structure_log);
+    int entry = sizeof(int) + sizeof(LineInfo);
+
+    if (len < fixed) return 0;
+    memcpy(header, data, sizeof(header));
+    if (header[1] < 0 || header[1] > (len - fixed) / entry) return 0;
+
+    Document doc = {NULL};
+    int truncated;
+    int offset = fixed + header[1] * entry;
+    if (document_parse(&doc, data + offset, len - offset, &truncated) < 0) return 0;
+
+    document_free(&editor->doc);
+    editor->doc = doc;
+    editor->structure = header[0];
+    memcpy(editor->structure_log, data + sizeof(header), sizeof(editor->structure_log));
+    g_hash_table_remove_all(editor->line_state);
+    for (int i = 0; i < header[1]; i++) {
+        const char *record = data + fixed + i * entry;
+        int line;
+        LineInfo *info = g_new(LineInfo, 1);
+        memcpy(&line, record, sizeof(int));
+        memcpy(info, record + sizeof(int), sizeof(LineInfo));
+        g_hash_table_insert(editor->line_state, GINT_TO_POINTER(line), info);
+    }
+
+    if (!editor->headless) {
+        int count = document_line_count(&editor->doc);
+        view_reset(editor);
+        gtk_spin_button_set_range(GTK_SPIN_BUTTON(editor->line_spin), 1, count);
+        gtk_spin_button_set_range(GTK_SPIN_BUTTON(editor->range_spin), 1, count);
+        update_status(NULL, editor);
+    }
+    return 1;
+}
+
+/**
+ * Recebe um pedaço do snapshot pedido por este rank; com o último, instala
+ */
+void sync_receive(EditorData *editor, const Message *msg, const char *payload, int len) {
+    long long offset = (long long)msg->args[0] * SYNC_CHUNK_BYTES;
+
+    if (!editor->syncing || msg->line_number <= 0) return;
+    if (editor->sync_data == NULL) {
+        editor->sync_data = g_malloc(msg->line_number);
+        editor->sync_len = msg->line_number;
+        editor->sync_received = 0;
+    }
+    if (msg->line_number != editor->sync_len || offset < 0 || offset + len > editor->sync_len) return;
+
+    memcpy(editor->sync_data + offset, payload, len);
+    editor->sync_received += len;
+    if (editor->sync_received < editor->sync_len) return;
+
+    char log_msg[256];
+    if (sync_install(editor)) {
+        // O documento foi trocado sem registros: o diário recomeça deste snapshot
+        if (editor->journal != NULL) journal_snapshot_held(editor);
+        g_hash_table_remove_all(editor->refetches);
+        g_hash_table_remove_all(editor->released_writes);
+        g_hash_table_remove_all(editor->released_before);
+        snprintf(log_msg, sizeof(log_msg), "Documento sincronizado com %s: %d linhas, %d KiB em %d ms",
+                 user_name(editor, msg->sender_rank), document_line_count(&editor->doc),
+                 editor->sync_len / 1024, (int)((g_get_monotonic_time() - editor->sync_started) / 1000));
+    } else {
+        snprintf(log_msg, sizeof(log_msg), "Snapshot de %s inválido: réplica mantida",
+                 user_name(editor, msg->sender_rank));
+    }
+    append_log(editor, log_msg);
+    g_free(editor->sync_data);
+    editor->sync_data = NULL;
+    editor->syncing = FALSE;
+
+    // O que chegou durante a transferência, na ordem de chegada
+    while (!g_queue_is_empty(&editor->sync_pending)) {
+        UiSlot *slot = g_queue_pop_head(&editor->sync_pending);
+        if (message_structure(&slot->msg) > editor->structure) {
+            g_queue_push_tail(&editor->structure_pending, slot);
+            continue;
+        }
+        ui_slot_apply(editor, slot);
+        g_free(slot);
+    }
+    structure_retry_pending(editor);
+}
+
+/**
+ * Drena o anel de atualizações aplicando todas as mensagens pendentes
+ * em um único lote
+ * Uma mensagem numerada depois de uma inserção ou remoção de linha que
+ * ainda não chegou aqui espera em structure_pending; durante uma
+ * sincronização, tudo menos o snapshot espera em sync_pending.
+ * Retorna o número de mensagens aplicadas.
+ */
+int ui_ring_drain(EditorData *editor) {
+    unsigned int head = atomic_load_explicit(&update_ring.head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&update_ring.tail, memory_order_acquire);
+    int applied = 0;
+
+    if (head == tail) return 0;
+
+    pthread_mutex_lock(&update_mutex);
+    ui_batch_begin(editor);
+    while (head != tail && applied < UI_DRAIN_MAX) {
+        UiSlot *slot = &update_ring.slots[head & (UI_RING_SIZE - 1)];
+        int structure = editor->structure;
+        if (slot->msg.type == MSG_SYNC_DATA) {
+            sync_receive(editor, &slot->msg, slot->payload, slot->payload_len);
+            g_free(slot->payload);
+            slot->payload = NULL;
+        } else if (editor->syncing) {
+            ui_slot_defer(&editor->sync_pending, slot);
+        } else if (message_structure(&slot->msg) > structure) {
+            ui_slot_defer(&editor->structure_pending, slot);
+        } else {
+            ui_slot_apply(editor, slot);
+            if (editor->structure != structure) structure_retry_pending(editor);
+        }
+        head++;
+        applied++;
+        if (head == tail) {
+            tail = atomic_load_explicit(&update_ring.tail, memory_order_acquire);
+        }
+    }
+    atomic_store_explicit(&update_ring.head, head, memory_order_release);
+    ui_batch_end(editor);
+    pthread_mutex_unlock(&update_mutex);
+
+    return applied;
+}
+
+/**
+ * Callback por quadro: drena o anel e se remove quando ele fica vazio
+ */
+gboolean ui_ring_tick(GtkWidget *widget, GdkFrameClock *clock, gpointer data) {
+    EditorData *editor = (EditorData *)data;
+
+    ui_ring_drain(editor);
+
+    atomic_store(&update_ring.drain_scheduled, 0);
+    unsigned int head = atomic_load(&update_ring.head);
+    if (head != atomic_load(&update_ring.tail) &&
+        !atomic_exchange(&update_ring.drain_scheduled, 1)) {
+        return G_SOURCE_CONTINUE;
+    }
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Registra o callback por quadro (executa na thread da interface)
+ * Sem interface não há relógio de quadros: drena a cada volta do laço
+ * principal enquanto houver mensagens.
+ */
+gboolean ui_ring_schedule(gpointer data) {
+    EditorData *editor = (EditorData *)data;
+    if (editor->headless) return ui_ring_tick(NULL, NULL, editor);
+    gtk_widget_add_tick_callback(editor->text_view, ui_ring_tick, editor, NULL);
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Número de slots livres no anel da interface (visão do produtor)
+ */
+int ui_ring_free(void) {
+    unsigned int tail = atomic_load_explicit(&update_ring.tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&update_ring.head, memory_order_acquire);
+    return UI_RING_SIZE - (int)(tail - head);
+}
+
+/**
+ * Copia uma mensagem para o anel da interface (somente o motor chama)
+ * Os registros de um lote são copiados para um buffer próprio do slot.
+ * Retorna 0 se o anel está cheio.
+ */
+int ui_ring_push(EditorData *editor, const Message *msg, const char *records, int records_len) {
+    unsigned int tail = atomic_load_explicit(&update_ring.tail, memory_order_relaxed);
+
+    if (ui_ring_free() <= 0) return 0;
+
+    UiSlot *slot = &update_ring.slots[tail & (UI_RING_SIZE - 1)];
+    slot->msg = *msg;
+    slot->payload = NULL;
+    slot->payload_len = 0;
+    if (records) {
+        slot->payload = g_malloc(records_len + 1);
+        memcpy(slot->payload, records, records_len);
+        slot->payload_len = records_len;
+    }
+
+    atomic_store_explicit(&update_ring.tail, tail + 1, memory_order_release);
+
+    if (!atomic_exchange(&update_ring.drain_scheduled, 1)) {
+        g_idle_add(ui_ring_schedule, editor);
+    }
+    return 1;
+}
+
+/**
+ * Anuncia uma mudança de dono de [start, end) a todos os ranks, inclusive
+ * a interface local
+ * Ao liberar, token é o da concessão encerrada e revoked indica que ela
+ * venceu: os ranks passam a recusar escritas com esse token.
+ */
+void engine_publish_owner(EditorData *editor, LockManager *locks, int start, int end, int owner,
+                          int token, int revoked) {
+    Message msg;
+    msg.type = MSG_LINE_LOCK_OWNER;
+    msg.line_number = start;
+    msg.sender_rank = editor->rank;
+    msg.args[0] = owner;
+    msg.args[1] = end;
+    msg.args[2] = token;
+    msg.args[3] = revoked;
+    msg.args[4] = locks->structure;
+    comm_broadcast(&msg);
+    ui_ring_push(editor, &msg, NULL, 0);
+}
+
+/**
+ * Envia à interface local o resultado do pedido de faixa
+ */
+void engine_notify_lock(EditorData *editor, int type, int start, int end, int holder) {
+    Message msg;
+    msg.type = type;
+    msg.line_number = start;
+    msg.sender_rank = holder;
+    msg.args[0] = end;
+    ui_ring_push(editor, &msg, NULL, 0);
+}
+
+/**
+ * Primeira faixa bloqueada que intersecta [start, end), ou -1
+ * Busca binária: as faixas são disjuntas e ordenadas, então os fins também.
+ */
+int held_first_overlap(LockManager *locks, int start, int end) {
+    int lo = 0, hi = locks->nheld;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (locks->held[mid].end <= start) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo < locks->nheld && locks->held[lo].start < end) return lo;
+    return -1;
+}
+
+/**
+ * Insere uma faixa livre mantendo a ordem
+ * A concessão recebe um novo token e um lease de LOCK_LEASE_MS.
+ */
+HeldRange *held_insert(LockManager *locks, int start, int end, int owner) {
+    int lo = 0, hi = locks->nheld;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (locks->held[mid].start < start) lo = mid + 1;
+        else hi = mid;
+    }
+
+    if (locks->nheld == locks->cap) {
+        locks->cap = locks->cap ? locks->cap * 2 : 16;
+        locks->held = g_realloc(locks->held, locks->cap * sizeof(HeldRange));
+    }
+    memmove(&locks->held[lo + 1], &locks->held[lo], (locks->nheld - lo) * sizeof(HeldRange));
+    locks->held[lo].start = start;
+    locks->held[lo].end = end;
+    locks->held[lo].owner = owner;
+    locks->held[lo].token = ++locks->next_token;
+    locks->held[lo].expires = g_get_monotonic_time() + (gint64)LOCK_LEASE_MS * 1000;
+    locks->nheld++;
+    return &locks->held[lo];
+}
+
+/**
+ * Concede [start, end) a owner e anuncia o novo dono
+ */
+int lock_manager_grant(EditorData *editor, LockManager *locks, int start, int end, int owner) {
+    HeldRange *h = held_insert(locks, start, end, owner);
+    engine_publish_owner(editor, locks, start, end, owner, h->token, 0);
+    return h->token;
+}
+
+/**
+ * Envia uma resposta de bloqueio do home ao solicitante (pode ser este rank)
+ * Uma concessão leva o token: o anúncio do novo dono pode chegar depois dela.
+ */
+void lock_reply(EditorData *editor, int type, int dest, int start, int end, int id,
+                int holder, int position, int token) {
+    Message reply;
+    reply.type = type;
+    reply.line_number = start;
+    reply.sender_rank = holder;
+    reply.args[0] = end;
+    reply.args[1] = id;
+    reply.args[2] = position;
+    reply.args[3] = token;
+    comm_send(dest, &reply);
+}
+
+/**
+ * Rank que impede a concessão de [start, end): o dono de uma faixa
+ * bloqueada ou, sem ela, o primeiro da fila com quem o pedido conflita
+ * Considera só os waiters anteriores a stop (NULL = fila inteira).
+ * Retorna -1 se nada impede.
+ */
+int lock_blocker(LockManager *locks, int start, int end, GList *stop) {
+    int i = held_first_overlap(locks, start, end);
+    if (i >= 0) return locks->held[i].owner;
+
+    for (GList *node = locks->waiters.head; node != stop; node = node->next) {
+        LockWaiter *w = node->data;
+        if (w->start < end && start < w->end) return w->requester;
+    }
+    return -1;
+}
+
+/**
+ * Concede os pedidos da fila que ficaram livres, em ordem de chegada, e
+ * informa a nova posição aos que continuam esperando
+ * Um pedido só passa à frente de outro anterior se as faixas não se tocam.
+ */
+void lock_waiters_advance(EditorData *editor, LockManager *locks) {
+    GList *node = locks->waiters.head;
+
+    while (node != NULL) {
+        LockWaiter *w = node->data;
+        GList *next = node->next;
+
+        if (lock_blocker(locks, w->start, w->end, node) < 0) {
+            g_queue_delete_link(&locks->waiters, node);
+            int token = lock_manager_grant(editor, locks, w->start, w->end, w->requester);
+            lock_reply(editor, MSG_LINE_LOCK_GRANTED, w->requester, w->start, w->end, w->id,
+                       editor->rank, 0, token);
+            g_free(w);
+        }
+        node = next;
+    }
+
+    for (node = locks->waiters.head; node != NULL; node = node->next) {
+        LockWaiter *w = node->data;
+        int position = 1;
+        for (GList *prev = locks->waiters.head; prev != node; prev = prev->next) {
+            LockWaiter *p = prev->data;
+            if (p->start < w->end && w->start < p->end) position++;
+        }
+        if (position == w->position) continue;
+
+        w->position = position;
+        lock_reply(editor, MSG_LINE_LOCK_QUEUED, w->requester, w->start, w->end, w->id,
+                   lock_blocker(locks, w->start, w->end, node), position, 0);
+    }
+}
+
+/**
+ * Arbitra um pedido de [start, end) como home (faixa dentro de um bloco)
+ * Concede tudo ou nada; em conflito o pedido entra na fila e o solicitante
+ * recebe MSG_LINE_LOCK_QUEUED. Retorna -1 se concedido, senão o rank que
+ * bloqueia.
+ */
+int lock_manager_try(EditorData *editor, LockManager *locks, int start, int end, int requester,
+                     int id) {
+    int i = held_first_overlap(locks, start, end);
+    if (i >= 0) {
+        HeldRange *h = &locks->held[i];
+        if (h->owner == requester && h->start == start && h->end == end) return -1;
+    }
+
+    int holder = lock_blocker(locks, start, end, NULL);
+    if (holder < 0) {
+        lock_manager_grant(editor, locks, start, end, requester);
+        return -1;
+    }
+
+    LockWaiter *w = g_new(LockWaiter, 1);
+    w->start = start;
+    w->end = end;
+    w->requester = requester;
+    w->id = id;
+    w->position = 0;
+    g_queue_push_tail(&locks->waiters, w);
+    lock_waiters_advance(editor, locks);
+    return holder;
+}
+
+/**
+ * Libera como home as faixas de holder dentro de [start, end) e passa a
+ * vez aos pedidos da fila
+ */
+void lock_manager_release(EditorData *editor, LockManager *locks, int start, int end, int holder) {
+    int i = held_first_overlap(locks, start, end);
+    if (i < 0) return;
+
+    while (i < locks->nheld && locks->held[i].start < end) {
+        HeldRange h = locks->held[i];
+        if (h.owner != holder) {
+            i++;
+            continue;
+        }
+        memmove(&locks->held[i], &locks->held[i + 1], (locks->nheld - i - 1) * sizeof(HeldRange));
+        locks->nheld--;
+        engine_publish_owner(editor, locks, h.start, h.end, -1, h.token, 0);
+    }
+    lock_waiters_advance(editor, locks);
+}
+
+/**
+ * Renova como home os leases de holder dentro de [start, end)
+ */
+void lock_manager_renew(LockManager *locks, int start, int end, int holder) {
+    int i = held_first_overlap(locks, start, end);
+    if (i < 0) return;
+
+    gint64 expires = g_get_monotonic_time() + (gint64)LOCK_LEASE_MS * 1000;
+    for (; i < locks->nheld && locks->held[i].start < end; i++) {
+        if (locks->held[i].owner == holder) locks->held[i].expires = expires;
+    }
+}
+
+/**
+ * Recolhe as concessões cujo dono parou de renovar (rank travado ou morto)
+ * O token recolhido é anunciado para que escritas atrasadas do antigo dono
+ * sejam recusadas.
+ */
+void lock_manager_sweep(EditorData *editor, LockManager *locks, gint64 now) {
+    int expired = 0;
+
+    for (int i = 0; i < locks->nheld; ) {
+        HeldRange h = locks->held[i];
+        if (h.expires > now) {
+            i++;
+            continue;
+        }
+        memmove(&locks->held[i], &locks->held[i + 1], (locks->nheld - i - 1) * sizeof(HeldRange));
+        locks->nheld--;
+        engine_publish_owner(editor, locks, h.start, h.end, -1, h.token, 1);
+        expired++;
+    }
+    if (expired) lock_waiters_advance(editor, locks);
+}
+
+/**
+ * Retira como home o pedido id de requester da fila
+ * Se o segmento já tinha sido concedido (a concessão cruzou com o
+ * cancelamento), ele é liberado.
+ */
+void lock_manager_cancel(EditorData *editor, LockManager *locks, int start, int end,
+                         int requester, int id) {
+    for (GList *node = locks->waiters.head; node != NULL; node = node->next) {
+        LockWaiter *w = node->data;
+        if (w->requester == requester && w->id == id && w->start == start) {
+            g_queue_delete_link(&locks->waiters, node);
+            g_free(w);
+            lock_waiters_advance(editor, locks);
+            return;
+        }
+    }
+    lock_manager_release(editor, locks, start, end, requester);
+}
+
+/**
+ * Libera [start, end) deste rank, segmento por segmento, em cada home
+ */
+void range_release(EditorData *editor, LockManager *locks, int start, int end) {
+    for (int line = start; line < end; ) {
+        int seg_end = lock_segment_end(line, end);
+        int home = lock_home(editor, line);
+
+        if (home == editor->rank) {
+            lock_manager_release(editor, locks, line, seg_end, editor->rank);
+        } else {
+            Message msg;
+            msg.type = MSG_LINE_UNLOCK;
+            msg.line_number = line;
+            msg.sender_rank = editor->rank;
+            msg.args[0] = seg_end;
+            comm_send(home, &msg);
+        }
+        line = seg_end;
+    }
+}
+
+/**
+ * Pede os próximos segmentos da faixa local; os homes locais respondem na
+ * hora, e para um home remoto (ou um segmento na fila) espera a resposta
+ */
+void range_request_next(EditorData *editor, LockManager *locks) {
+    while (locks->acquiring) {
+        if (locks->acq_next >= locks->acq_end) {
+            locks->acquiring = 0;
+            engine_notify_lock(editor, MSG_LINE_LOCK_GRANTED, locks->acq_start, locks->acq_end,
+                               editor->rank);
+            return;
+        }
+
+        int seg_end = lock_segment_end(locks->acq_next, locks->acq_end);
+        int home = lock_home(editor, locks->acq_next);
+
+        if (home != editor->rank) {
+            Message msg;
+            msg.type = MSG_LINE_LOCK_REQUEST;
+            msg.line_number = locks->acq_next;
+            msg.sender_rank = editor->rank;
+            msg.args[0] = seg_end;
+            msg.args[1] = locks->acq_id;
+            msg.args[2] = locks->acq_structure;
+            comm_send(home, &msg);
+            return;
+        }
+
+        // Em conflito, a concessão chega depois como MSG_LINE_LOCK_GRANTED
+        if (lock_manager_try(editor, locks, locks->acq_next, seg_end, editor->rank,
+                             locks->acq_id) >= 0) {
+            return;
+        }
+        locks->acq_next = seg_end;
+    }
+}
+
+/**
+ * Desiste do pedido de faixa local: retira o segmento pendente da fila do
+ * home e devolve os segmentos já obtidos
+ */
+void range_cancel(EditorData *editor, LockManager *locks, int timed_out) {
+    if (!locks->acquiring) return;
+
+    int seg_end = lock_segment_end(locks->acq_next, locks->acq_end);
+    int home = lock_home(editor, locks->acq_next);
+
+    if (home == editor->rank) {
+        lock_manager_cancel(editor, locks, locks->acq_next, seg_end, editor->rank, locks->acq_id);
+    } else {
+        Message msg;
+        msg.type = MSG_LINE_LOCK_CANCEL;
+        msg.line_number = locks->acq_next;
+        msg.sender_rank = editor->rank;
+        msg.args[0] = seg_end;
+        msg.args[1] = locks->acq_id;
+        comm_send(home, &msg);
+    }
+
+    range_release(editor, locks, locks->acq_start, locks->acq_next);
+    locks->acquiring = 0;
+
+    Message msg;
+    msg.type = MSG_RANGE_CANCEL;
+    msg.line_number = locks->acq_start;
+    msg.sender_rank = editor->rank;
+    msg.args[0] = locks->acq_end;
+    msg.args[1] = timed_out;
+    ui_ring_push(editor, &msg, NULL, 0);
+}
+
+/**
+ * Trata a resposta de um home a um segmento do pedido local
+ * Respostas de pedidos já cancelados são descartadas pelo identificador.
+ */
+void range_on_reply(EditorData *editor, LockManager *locks, const Message *msg) {
+    if (!locks->acquiring || msg->args[1] != locks->acq_id ||
+        msg->line_number != locks->acq_next) {
+        return;
+    }
+
+    if (msg->type == MSG_LINE_LOCK_GRANTED) {
+        // O anúncio do home vai pela árvore de difusão e pode chegar depois:
+        // a interface recebe o token do segmento antes da concessão da faixa
+        Message owner;
+        owner.type = MSG_LINE_LOCK_OWNER;
+        owner.line_number = msg->line_number;
+        owner.sender_rank = msg->sender_rank;
+        owner.args[0] = editor->rank;
+        owner.args[1] = msg->args[0];
+        owner.args[2] = msg->args[3];
+        owner.args[3] = 0;
+        owner.args[4] = locks->structure;
+        ui_ring_push(editor, &owner, NULL, 0);
+        locks->acq_next = msg->args[0];
+        range_request_next(editor, locks);
+    } else if (msg->type == MSG_LINE_LOCK_QUEUED) {
+        Message queued = *msg;
+        queued.line_number = locks->acq_start;
+        queued.args[0] = locks->acq_end;
+        ui_ring_push(editor, &queued, NULL, 0);
+    } else {
+        range_release(editor, locks, locks->acq_start, locks->acq_next);
+        locks->acquiring = 0;
+        engine_notify_lock(editor, MSG_LINE_LOCK_DENIED, locks->acq_start, locks->acq_end,
+                           msg->sender_rank);
+    }
+}
+
+/**
+ * Bloqueia [start, end) com MPI_Compare_and_swap nas janelas dos homes
+ * Sincronização passiva: os processos alvo não participam. Todas as
+ * operações são emitidas antes de um único flush; se alguma linha estiver
+ * ocupada, as obtidas são devolvidas.
+ */
+void rma_range_acquire(EditorData *editor, LockManager *locks, int start, int end) {
+    int count = end - start;
+    int *previous = g_new(int, count);
+    int desired = editor->rank;
+    int expected = -1;
+    int holder = -1;
+
+    for (int i = 0; i < count; i++) {
+        MPI_Compare_and_swap(&desired, &expected, &previous[i], MPI_INT,
+                             lock_home(editor, start + i), lock_slot(editor, start + i),
+                             editor->lock_win);
+    }
+    MPI_Win_flush_all(editor->lock_win);
+
+    for (int i = 0; i < count && holder < 0; i++) {
+        if (previous[i] != -1 && previous[i] != editor->rank) holder = previous[i];
+    }
+
+    if (holder >= 0) {
+        int released = -1;
+        int mine = editor->rank;
+        int ignored;
+        for (int i = 0; i < count; i++) {
+            if (previous[i] != -1) continue;
+            MPI_Compare_and_swap(&released, &mine, &ignored, MPI_INT,
+                                 lock_home(editor, start + i), lock_slot(editor, start + i),
+                                 editor->lock_win);
+            MPI_Win_flush(lock_home(editor, start + i), editor->lock_win);
+        }
+        engine_notify_lock(editor, MSG_LINE_LOCK_DENIED, start, end, holder);
+    } else {
+        engine_notify_lock(editor, MSG_LINE_LOCK_GRANTED, start, end, editor->rank);
+        engine_publish_owner(editor, locks, start, end, editor->rank, 0, 0);
+    }
+    g_free(previous);
+}
+
+/**
+ * Libera [start, end) nas janelas RMA onde este rank ainda é o dono
+ */
+void rma_range_release(EditorData *editor, LockManager *locks, int start, int end) {
+    int desired = -1;
+    int expected = editor->rank;
+    int previous;
+
+    for (int line = start; line < end; line++) {
+        MPI_Compare_and_swap(&desired, &expected, &previous, MPI_INT, lock_home(editor, line),
+                             lock_slot(editor, line), editor->lock_win);
+        MPI_Win_flush(lock_home(editor, line), editor->lock_win);
+    }
+    engine_publish_owner(editor, locks, start, end, -1, 0, 0);
+}
+
+/**
+ * Valida uma faixa [start, end) de um documento com lines linhas
+ */
+int valid_range(int start, int end, int lines) {
+    return start >= 0 && start < end && end <= lines;
+}
+
+/**
+ * Próxima versão de uma linha deste home no modo otimista
+ */
+int lock_version_next(LockManager *locks, int line) {
+    int version = GPOINTER_TO_INT(g_hash_table_lookup(locks->versions, GINT_TO_POINTER(line))) + 1;
+    g_hash_table_insert(locks->versions, GINT_TO_POINTER(line), GINT_TO_POINTER(version));
+    return version;
+}
+
+/**
+ * Aplica no motor uma inserção ou remoção de linha ordenada pelo rank 0
+ * Toda faixa concedida por este home a partir da cauda bloqueada pelo
+ * solicitante é dele e termina aqui. Pedidos na fila que alcançam a cauda
+ * foram numerados antes da operação e são negados.
+ */
+void structure_engine_apply(EditorData *editor, LockManager *locks, const Message *msg) {
+    int line = msg->line_number;
+    int tail = line < locks->lines ? line : locks->lines - 1;
+    int kept = 0;
+
+    for (int i = 0; i < locks->nheld; i++) {
+        if (locks->held[i].end <= tail) locks->held[kept++] = locks->held[i];
+    }
+    locks->nheld = kept;
+
+    for (GList *node = locks->waiters.head; node != NULL; ) {
+        GList *next = node->next;
+        LockWaiter *w = node->data;
+        if (w->end > tail) {
+            lock_reply(editor, MSG_LINE_LOCK_DENIED, w->requester, w->start, w->end, w->id, -1, 0, 0);
+            g_queue_delete_link(&locks->waiters, node);
+            g_free(w);
+        }
+        node = next;
+    }
+
+    locks->lines += msg->type == MSG_LINE_INSERT ? 1 : -1;
+    locks->structure++;
+}
+
+/**
+ * Processa um quadro recebido ou destinado a este próprio rank
+ * Pedidos e liberações de bloqueio são arbitrados aqui, no motor; o resto
+ * vai para o anel da interface. Retorna 0 se o anel não tem espaço (nada é
+ * alterado e o quadro deve ser reprocessado depois). Quadros malformados
+ * são descartados.
+ */
+int engine_dispatch(EditorData *editor, LockManager *locks, const char *data, int len) {
+    Message msg;
+    const char *records;
+    int records_len;
+
+    if (!wire_decode(data, len, &msg, &records, &records_len)) return 1;
+
+    switch (msg.type) {
+        case MSG_RANGE_LOCK:
+        case MSG_RANGE_UNLOCK:
+            // Pedido da interface local
+            if (msg.sender_rank != editor->rank || !valid_range(msg.line_number, msg.args[0], MAX_DOC_LINES)) {
+                return 1;
+            }
+            if (atomic_load(&running) && ui_ring_free() < LOCK_RING_RESERVE) return 0;
+
+            if (msg.type == MSG_RANGE_LOCK && msg.args[1] != locks->structure) {
+                // A interface ainda não viu uma inserção ou remoção que o motor já aplicou
+                engine_notify_lock(editor, MSG_LINE_LOCK_DENIED, msg.line_number, msg.args[0], -1);
+            } else if (editor->lock_backend == LOCK_BACKEND_RMA) {
+                if (msg.type == MSG_RANGE_LOCK) {
+                    rma_range_acquire(editor, locks, msg.line_number, msg.args[0]);
+                } else {
+                    rma_range_release(editor, locks, msg.line_number, msg.args[0]);
+                }
+            } else if (msg.type == MSG_RANGE_LOCK) {
+                if (locks->acquiring) return 1;
+                locks->acquiring = 1;
+                locks->acq_id++;
+                locks->acq_structure = msg.args[1];
+                locks->acq_start = msg.line_number;
+                locks->acq_end = msg.args[0];
+                locks->acq_next = msg.line_number;
+                locks->acq_deadline = editor->lock_timeout_s > 0
+                    ? g_get_monotonic_time() + (gint64)editor->lock_timeout_s * G_USEC_PER_SEC
+                    : 0;
+                range_request_next(editor, locks);
+            } else {
+                range_release(editor, locks, msg.line_number, msg.args[0]);
+            }
+            return 1;
+
+        case MSG_RANGE_CANCEL:
+            // A interface desistiu de esperar
+            if (msg.sender_rank != editor->rank) return 1;
+            if (atomic_load(&running) && ui_ring_free() < LOCK_RING_RESERVE) return 0;
+            range_cancel(editor, locks, 0);
+            return 1;
+
+        case MSG_LINE_COMMIT: {
+            // Commit otimista: o home aceita só se a base for a versão atual
+            int line = msg.line_number;
+            if (editor->edit_mode != EDIT_MODE_OPTIMISTIC || line < 0 || line >= locks->lines) return 1;
+            if (lock_home(editor, line) != editor->rank) return 1;
+            if (atomic_load(&running) && ui_ring_free() < LOCK_RING_RESERVE) return 0;
+
+            Message reply = msg;
+            int current = GPOINTER_TO_INT(g_hash_table_lookup(locks->versions, GINT_TO_POINTER(line)));
+            if (msg.args[0] == current) {
+                // Um commit por delta segue como delta: a base é a versão atual em toda réplica
+                reply.type = msg.args[2] >= 0 ? MSG_LINE_DELTA : MSG_LINE_UPDATE;
+                reply.args[0] = 0;
+                reply.args[1] = lock_version_next(locks, line);
+                reply.args[2] = locks->structure;
+                reply.args[3] = msg.args[1];
+                reply.args[4] = msg.args[2];
+                reply.args[5] = msg.args[3];
+                comm_broadcast(&reply);
+                ui_ring_push(editor, &reply, NULL, 0);
+            } else {
+                reply.type = MSG_LINE_CONFLICT;
+                reply.sender_rank = editor->rank;
+                reply.args[0] = current;
+                reply.args[1] = msg.args[2] >= 0;
+                comm_send(msg.sender_rank, &reply);
+            }
+            return 1;
+        }
+
+        case MSG_LINE_SUBMIT_BATCH: {
+            // Lote da geração: o home numera as versões e o difunde a todos
+            if (editor->edit_mode != EDIT_MODE_OPTIMISTIC) return 1;
+            if (atomic_load(&running) && ui_ring_free() < LOCK_RING_RESERVE) return 0;
+
+            int offset = 0;
+            for (int i = 0; i < msg.line_number && offset + 2 * (int)sizeof(int) <= records_len; i++) {
+                int line, length;
+                memcpy(&line, records + offset, sizeof(int));
+                memcpy(&length, records + offset + sizeof(int), sizeof(int));
+                offset += 2 * sizeof(int);
+                // Registro delta: checksum, prefixo e sufixo antes do trecho (ver apply_line_batch)
+                if (length < 0) {
+                    offset += DELTA_OVERHEAD;
+                    length = -1 - length;
+                }
+                if (offset + length > records_len) break;
+                if (line >= 0 && line < locks->lines && lock_home(editor, line) == editor->rank) {
+                    lock_version_next(locks, line);
+                }
+                offset += length;
+            }
+
+            WireHeader header;
+            memcpy(&header, data, sizeof(WireHeader));
+            header.type = MSG_LINE_UPDATE_BATCH;
+            comm_send_frame(COMM_BROADCAST, &header, data + sizeof(WireHeader));
+
+            msg.type = MSG_LINE_UPDATE_BATCH;
+            return ui_ring_push(editor, &msg, records, records_len);
+        }
+
+        case MSG_LOCK_HEARTBEAT:
+            // Da interface local: repassa a cada home; de outro rank: renova aqui
+            if (!valid_range(msg.line_number, msg.args[0], MAX_DOC_LINES)) return 1;
+            if (editor->lock_backend == LOCK_BACKEND_RMA) return 1;
+
+            for (int line = msg.line_number; line < msg.args[0]; ) {
+                int seg_end = lock_segment_end(line, msg.args[0]);
+                int home = lock_home(editor, line);
+                if (home == editor->rank) {
+                    lock_manager_renew(locks, line, seg_end, msg.sender_rank);
+                } else if (msg.sender_rank == editor->rank) {
+                    Message beat = msg;
+                    beat.line_number = line;
+                    beat.args[0] = seg_end;
+                    comm_send(home, &beat);
+                }
+                line = seg_end;
+            }
+            return 1;
+
+        case MSG_LINE_LOCK_REQUEST:
+        case MSG_LINE_LOCK_CANCEL:
+        case MSG_LINE_UNLOCK: {
+            // Segmento de faixa endereçado a este rank como home
+            int start = msg.line_number;
+            int end = msg.args[0];
+            if (!valid_range(start, end, MAX_DOC_LINES) || lock_segment_end(start, end) != end) return 1;
+            if (lock_home(editor, start) != editor->rank) return 1;
+            if (atomic_load(&running) && ui_ring_free() < LOCK_RING_RESERVE) return 0;
+
+            if (msg.type == MSG_LINE_LOCK_REQUEST && (msg.args[2] != locks->structure || end > locks->lines)) {
+                // Numerado antes ou depois de uma inserção ou remoção que este home vê diferente
+                lock_reply(editor, MSG_LINE_LOCK_DENIED, msg.sender_rank, start, end, msg.args[1], -1, 0, 0);
+            } else if (msg.type == MSG_LINE_LOCK_REQUEST) {
+                // Em conflito, lock_manager_try já respondeu com MSG_LINE_LOCK_QUEUED
+                if (lock_manager_try(editor, locks, start, end, msg.sender_rank, msg.args[1]) < 0) {
+                    lock_reply(editor, MSG_LINE_LOCK_GRANTED, msg.sender_rank, start, end,
+                               msg.args[1], editor->rank, 0,
+                               locks->held[held_first_overlap(locks, start, end)].token);
+                }
+            } else if (msg.type == MSG_LINE_LOCK_CANCEL) {
+                lock_manager_cancel(editor, locks, start, end, msg.sender_rank, msg.args[1]);
+            } else {
+                lock_manager_release(editor, locks, start, end, msg.sender_rank);
+            }
+            return 1;
+        }
+
+        case MSG_LINE_LOCK_GRANTED:
+        case MSG_LINE_LOCK_DENIED:
+        case MSG_LINE_LOCK_QUEUED:
+            // Resposta de um home a um segmento do pedido local
+            if (atomic_load(&running) && ui_ring_free() < LOCK_RING_RESERVE) return 0;
+            range_on_reply(editor, locks, &msg);
+            return 1;
+
+        case MSG_LINE_INSERT:
+        case MSG_LINE_DELETE:
+            // Operação estrutural: o rank 0 ordena, todos os motores aplicam na mesma ordem
+            if (editor->edit_mode != EDIT_MODE_LOCK || editor->lock_backend != LOCK_BACKEND_MSG) return 1;
+            if (atomic_load(&running) && ui_ring_free() < LOCK_RING_RESERVE) return 0;
+
+            if (msg.args[1] == STRUCTURE_REQUEST) {
+                if (editor->rank != 0 || msg.sender_rank < 0 || msg.sender_rank >= editor->size) return 1;
+                int insert = msg.type == MSG_LINE_INSERT;
+                int last = insert ? locks->lines : locks->lines - 1;
+                int full = insert ? locks->lines >= MAX_DOC_LINES : locks->lines <= 1;
+
+                msg.args[2] = msg.sender_rank;
+                if (msg.args[0] != locks->structure || msg.line_number < 0 || msg.line_number > last || full) {
+                    msg.args[1] = STRUCTURE_REJECT;
+                    comm_send(msg.args[2], &msg);
+                    return 1;
+                }
+                msg.args[1] = STRUCTURE_APPLY;
+                msg.sender_rank = editor->rank;
+                comm_broadcast(&msg);
+            } else if (msg.args[1] == STRUCTURE_REJECT) {
+                ui_ring_push(editor, &msg, NULL, 0);
+                return 1;
+            } else if (msg.sender_rank != 0 || msg.args[0] != locks->structure) {
+                return 1;
+            }
+            structure_engine_apply(editor, locks, &msg);
+            ui_ring_push(editor, &msg, NULL, 0);
+            return 1;
+
+        case MSG_EXPORT:
+            // Exportação coletiva: o rank 0 a ordena entre as operações estruturais
+            if (msg.args[0] == EXPORT_REQUEST) {
+                if (editor->rank != 0 || !atomic_load(&running)) return 1;
+                if (ui_ring_free() < LOCK_RING_RESERVE) return 0;
+                msg.args[0] = EXPORT_APPLY;
+                msg.args[1] = locks->structure;
+                msg.args[2] = msg.sender_rank;
+                msg.sender_rank = editor->rank;
+                comm_broadcast(&msg);
+                return ui_ring_push(editor, &msg, NULL, 0);
+            }
+            if (msg.args[0] != EXPORT_APPLY || msg.sender_rank != 0) return 1;
+            return ui_ring_push(editor, &msg, NULL, 0);
+
+        case MSG_RANK_LEAVE:
+            // Depois de sair, a interface deste rank não drena mais o anel
+            if (atomic_load(&running) && !ui_ring_push(editor, &msg, NULL, 0)) return 0;
+            atomic_fetch_add(&fanout_left, 1);
+            return 1;
+
+        default:
+            return ui_ring_push(editor, &msg, records, records_len);
+    }
+}
+
+/**
+ * Inicializa o pool de envios assíncronos
+ */
+void send_pool_init(SendPool *pool, int size) {
+    for (int i = 0; i < COMM_MAX_INFLIGHT; i++) {
+        pool->req[i] = MPI_REQUEST_NULL;
+        pool->out[i] = NULL;
+        pool->free_slots[i] = COMM_MAX_INFLIGHT - 1 - i;
+    }
+    pool->nfree = COMM_MAX_INFLIGHT;
+    pool->dests = g_new0(DestQueue, size);
+    pool->next_dest = 0;
+    pool->queued = 0;
+    pool->data_seq = 0;
+}
+
+/**
+ * Libera uma referência a uma mensagem de saída
+ */
+void outbound_release(OutboundMsg *out) {
+    if (--out->refs == 0) g_free(out);
+}
+
+/**
+ * Coloca uma mensagem na fila do destino
+ */
+void send_pool_enqueue(SendPool *pool, int dest, OutboundMsg *out) {
+    PendingSend *item = g_new(PendingSend, 1);
+    item->next = NULL;
+    item->out = out;
+    item->seq = out->lane == LANE_DATA ? pool->data_seq++ : 0;
+    out->refs++;
+
+    DestQueue *q = &pool->dests[dest];
+    int lane = out->lane;
+    if (q->tail[lane]) q->tail[lane]->next = item;
+    else q->head[lane] = item;
+    q->tail[lane] = item;
+    pool->queued++;
+    stat_peak(&lane_stats[lane].queued_peak, atomic_fetch_add(&lane_stats[lane].queued, 1) + 1);
+}
+
+/**
+ * Filhos de rank na árvore binomial de difusão com raiz root, do maior
+ * subárvore para o menor. Retorna quantos são.
+ */
+int fanout_children(int rank, int root, int size, int *children) {
+    int relative = (rank - root + size) % size;
+    int mask = 1;
+    int count = 0;
+
+    // A subárvore de um rank cobre os bits abaixo do seu bit mais baixo
+    while (mask < size && !(relative & mask)) mask <<= 1;
+    for (mask >>= 1; mask > 0; mask >>= 1) {
+        if (relative + mask < size) children[count++] = (relative + mask + root) % size;
+    }
+    return count;
+}
+
+/**
+ * Indica se as difusões desta sessão vão pela árvore
+ * Com poucos ranks, as cópias diretas saem antes de um salto a mais; com
+ * muitos, o originador deixa de serializar N - 1 envios e a latência cresce
+ * com log N. A escolha vale para a sessão inteira: se um quadro fosse direto
+ * e o anterior pela árvore, o mais novo poderia chegar antes.
+ */
+int fanout_use_tree(EditorData *editor) {
+    if (editor->size <= 2 || editor->size > FANOUT_MAX_RANKS) return 0;
+    if (editor->fanout != FANOUT_AUTO) return editor->fanout == FANOUT_TREE;
+    return editor->size > FANOUT_LINEAR_MAX_RANKS;
+}
+
+/**
+ * Indica se o motor ainda precisa repassar quadros da árvore
+ * Um rank que saiu segue como nó interno até todos os ranks saírem: antes
+ * disso, difusões dos outros ainda passam por ele a caminho da subárvore.
+ */
+int fanout_holding(EditorData *editor) {
+    return fanout_use_tree(editor) && atomic_load(&fanout_left) < editor->size;
+}
+
+/**
+ * Repassa aos filhos deste rank um quadro recebido pela árvore com raiz root
+ */
+void fanout_relay(EditorData *editor, SendPool *pool, const char *data, int len, int root, int lane) {
+    int children[32];
+
+    if (root < 0 || root >= editor->size || root == editor->rank) return;
+    int count = fanout_children(editor->rank, root, editor->size, children);
+    if (count == 0) return;
+
+    OutboundMsg *out = g_malloc(sizeof(OutboundMsg) + len);
+    out->dest = COMM_BROADCAST;
+    out->refs = 1;
+    out->tag = FANOUT_TAG_BASE + root;
+    out->lane = lane;
+    out->barrier = 0;
+    out->len = len;
+    out->data = (char *)(out + 1);
+    memcpy(out->data, data, len);
+    for (int i = 0; i < count; i++) send_pool_enqueue(pool, children[i], out);
+    atomic_fetch_add(&comm_pending, count);
+    outbound_release(out);
+}
+
+/**
+ * Indica se todos os quadros de dados enfileirados antes de barrier já
+ * foram postados com MPI_Isend
+ */
+int send_pool_data_posted(SendPool *pool, int size, unsigned int barrier) {
+    for (int d = 0; d < size; d++) {
+        PendingSend *head = pool->dests[d].head[LANE_DATA];
+        if (head != NULL && (int)(head->seq - barrier) < 0) return 0;
+    }
+    return 1;
+}
+
+/**
+ * Indica se uma mensagem para o próprio rank já pode ser despachada
+ * A liberação de uma faixa espera os dados do commit saírem: o anúncio do
+ * novo dono vai pelo controle e, antes disso, passaria à frente da última
+ * escrita do dono anterior.
+ */
+int engine_local_ready(EditorData *editor, SendPool *pool, const OutboundMsg *out) {
+    WireHeader header;
+    memcpy(&header, out->data, sizeof(WireHeader));
+    return header.type != MSG_RANGE_UNLOCK || send_pool_data_posted(pool, editor->size, out->barrier);
+}
+
+/**
+ * Distribui uma mensagem da fila de saída nas filas por destino
+ * Mensagens para o próprio rank não passam pelo MPI: são despachadas
+ * localmente ou, se o anel estiver cheio ou uma liberação ainda esperar os
+ * dados do commit, guardadas em local_backlog.
+ */
+void engine_route(EditorData *editor, SendPool *pool, LockManager *locks,
+                  GQueue *local_backlog, OutboundMsg *out) {
+    out->refs = 1;
+    out->barrier = pool->data_seq;
+
+    if (out->dest == COMM_BROADCAST && fanout_use_tree(editor)) {
+        int children[32];
+        int count = fanout_children(editor->rank, editor->rank, editor->size, children);
+        out->tag = FANOUT_TAG_BASE + editor->rank;
+        for (int i = 0; i < count; i++) send_pool_enqueue(pool, children[i], out);
+        // comm_send_frame contou uma cópia por rank: o resto sai dos filhos
+        atomic_fetch_sub(&comm_pending, editor->size - 1 - count);
+    } else if (out->dest == COMM_BROADCAST) {
+        for (int i = 0; i < editor->size; i++) {
+            if (i != editor->rank) send_pool_enqueue(pool, i, out);
+        }
+    } else if (out->dest != editor->rank) {
+        send_pool_enqueue(pool, out->dest, out);
+    } else if (!g_queue_is_empty(local_backlog) || !engine_local_ready(editor, pool, out) ||
+               !engine_dispatch(editor, locks, out->data, out->len)) {
+        g_queue_push_tail(local_backlog, out);
+        return;
+    }
+    outbound_release(out);
+}
+
+/**
+ * Dispara MPI_Isend para as filas por destino, em round-robin, enquanto
+ * houver slots livres no pool
+ * Em cada destino o controle sai antes dos outros canais, sem o limite por
+ * destino e com LANE_SEND_RESERVE slots só seus: um pedido de bloqueio não
+ * espera os lotes já enfileirados para o mesmo rank.
+ * Retorna o número de envios iniciados.
+ */
+int send_pool_pump(EditorData *editor, SendPool *pool) {
+    int started = 0;
+    int stalled = 0;
+
+    while (pool->nfree > 0 && pool->queued > 0 && stalled < editor->size) {
+        int d = pool->next_dest;
+        pool->next_dest = (pool->next_dest + 1) % editor->size;
+
+        DestQueue *q = &pool->dests[d];
+        int lane = 0;
+        while (lane < COMM_LANES && !q->head[lane]) lane++;
+        if (lane == COMM_LANES || (lane != LANE_CONTROL && (q->inflight >= COMM_MAX_INFLIGHT_PER_DEST ||
+                                                           pool->nfree <= LANE_SEND_RESERVE))) {
+            stalled++;
+            continue;
+        }
+        stalled = 0;
+
+        PendingSend *item = q->head[lane];
+        q->head[lane] = item->next;
+        if (!q->head[lane]) q->tail[lane] = NULL;
+        pool->queued--;
+        atomic_fetch_sub(&lane_stats[lane].queued, 1);
+        atomic_fetch_add(&lane_stats[lane].sent, 1);
+
+        int slot = pool->free_slots[--pool->nfree];
+        pool->out[slot] = item->out;
+        pool->dest[slot] = d;
+        MPI_Isend(item->out->data, item->out->len, MPI_BYTE, d, item->out->tag, editor->lane_comm[lane],
+                  &pool->req[slot]);
+        q->inflight++;
+        g_free(item);
+        started++;
+    }
+
+    return started;
+}
+
+/**
+ * Recolhe os envios concluídos e devolve seus slots ao pool
+ * Retorna o número de envios completados.
+ */
+int send_pool_reap(SendPool *pool) {
+    int indices[COMM_MAX_INFLIGHT];
+    int outcount = 0;
+
+    if (pool->nfree == COMM_MAX_INFLIGHT) return 0;
+
+    MPI_Testsome(COMM_MAX_INFLIGHT, pool->req, &outcount, indices, MPI_STATUSES_IGNORE);
+    if (outcount == MPI_UNDEFINED) return 0;
+
+    for (int k = 0; k < outcount; k++) {
+        int slot = indices[k];
+        pool->dests[pool->dest[slot]].inflight--;
+        outbound_release(pool->out[slot]);
+        pool->out[slot] = NULL;
+        pool->free_slots[pool->nfree++] = slot;
+    }
+    atomic_fetch_sub(&comm_pending, outcount);
+
+    return outcount;
+}
+
+/**
+ * Grava a próxima faixa preparada pela interface com MPI-IO (coletiva)
+ * O deslocamento de cada rank no arquivo vem de um MPI_Exscan sobre os
+ * tamanhos das faixas, e todos gravam juntos com MPI_File_write_at_all.
+ * Todos os ranks entram aqui para a mesma exportação, na ordem do rank 0;
+ * enquanto isso o motor não atende outras mensagens.
+ */
+void export_collective(EditorData *editor) {
+    pthread_mutex_lock(&export_mutex);
+    ExportJob *job = g_queue_pop_head(&export_jobs);
+    pthread_mutex_unlock(&export_mutex);
+    atomic_fetch_sub(&export_queued, 1);
+
+    gint64 started = g_get_monotonic_time();
+    long long offset = 0, total = 0;
+    long long rounds = (job->len + EXPORT_WRITE_CHUNK - 1) / EXPORT_WRITE_CHUNK, max_rounds = 0;
+    MPI_File file;
+    int err, failed;
+
+    MPI_Exscan(&job->len, &offset, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    if (editor->rank == 0) offset = 0;          // MPI_Exscan não define o valor no rank 0
+    MPI_Allreduce(&job->len, &total, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Allreduce(&rounds, &max_rounds, 1, MPI_LONG_LONG, MPI_MAX, MPI_COMM_WORLD);
+
+    err = MPI_File_open(MPI_COMM_WORLD, job->path, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file);
+    failed = err != MPI_SUCCESS;
+    MPI_Allreduce(MPI_IN_PLACE, &failed, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    if (!failed) {
+        // Um arquivo anterior maior não deixa sobras no fim
+        err = MPI_File_set_size(file, total);
+        for (long long r = 0; r < max_rounds; r++) {
+            long long done = r * EXPORT_WRITE_CHUNK;
+            long long left = job->len - done;
+            int count = left <= 0 ? 0 : left < EXPORT_WRITE_CHUNK ? (int)left : EXPORT_WRITE_CHUNK;
+            int werr = MPI_File_write_at_all(file, offset + done, job->data + (count > 0 ? done : 0),
+                                             count, MPI_BYTE, MPI_STATUS_IGNORE);
+            if (err == MPI_SUCCESS) err = werr;
+        }
+        int cerr = MPI_File_close(&file);
+        if (err == MPI_SUCCESS) err = cerr;
+    } else if (err == MPI_SUCCESS) {
+        err = MPI_ERR_OTHER;                    // outro rank não conseguiu abrir
+    }
+
+    Message done;
+    done.type = MSG_EXPORT;
+    done.line_number = job->lines;
+    done.sender_rank = editor->rank;
+    done.args[0] = EXPORT_DONE;
+    done.args[1] = err;
+    done.args[2] = (int)((g_get_monotonic_time() - started) / 1000);
+    done.args[3] = (int)(total / 1024);
+    if (err == MPI_SUCCESS) {
+        snprintf(done.content, sizeof(done.content), "%s", job->path);
+    } else {
+        int len;
+        MPI_Error_string(err, done.content, &len);
+        done.content[MAX_LINE_LENGTH - 1] = '\0';
+    }
+    ui_ring_push(editor, &done, NULL, 0);
+
+    g_free(job->data);
+    g_free(job);
+}
+
+/**
+ * Dorme até ser acordado por um produtor ou até o timeout expirar
+ * Depois do encerramento só dorme se hold pedir (repasse da árvore).
+ */
+void engine_idle_wait(int timeout_us, int hold) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += (long)timeout_us * 1000;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+    }
+
+    pthread_mutex_lock(&engine_wake_mutex);
+    atomic_store(&engine_idle, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (outbound_empty(&outbound_queue) && (atomic_load(&running) || hold)) {
+        pthread_cond_timedwait(&engine_wake_cond, &engine_wake_mutex, &deadline);
+    }
+    atomic_store(&engine_idle, 0);
+    pthread_mutex_unlock(&engine_wake_mutex);
+}
+
+/**
+ * Entrega um quadro recebido no canal lane
+ * Os canais de dados e chat deixam LOCK_RING_RESERVE slots do anel para o
+ * controle. Retorna 0 se o quadro deve esperar.
+ */
+int recv_lane_deliver(EditorData *editor, LockManager *locks, int lane, const char *data, int len) {
+    // Depois de sair, o anel não é mais drenado: o que não cabe é descartado
+    if (lane != LANE_CONTROL && ui_ring_free() <= LOCK_RING_RESERVE) return !atomic_load(&running);
+    return engine_dispatch(editor, locks, data, len) || !atomic_load(&running);
+}
+
+/**
+ * Posta o MPI_Irecv de um slot do canal
+ */
+void recv_lane_post(RecvLane *rl, int slot) {
+    MPI_Irecv(rl->buf[slot], COMM_RECV_BUF_SIZE, MPI_BYTE, MPI_ANY_SOURCE, MPI_ANY_TAG, rl->comm, &rl->req[slot]);
+    rl->posted[slot] = rl->next_post++;
+}
+
+/**
+ * Atende um canal: entrega o que esperava espaço no anel e completa os
+ * MPI_Irecv do canal com MPI_Testsome
+ * Retorna o número de quadros entregues.
+ */
+int engine_poll_lane(EditorData *editor, SendPool *pool, LockManager *locks, RecvLane *rl, int lane) {
+    int indices[COMM_RECV_SLOTS];
+    MPI_Status statuses[COMM_RECV_SLOTS];
+    int outcount = 0;
+    int delivered = 0;
+
+    // Primeiro o que ficou estacionado com o anel cheio
+    while (rl->nparked > 0 &&
+           recv_lane_deliver(editor, locks, lane, rl->buf[rl->parked[0]], rl->len[rl->parked[0]])) {
+        int slot = rl->parked[0];
+        memmove(rl->parked, rl->parked + 1, (--rl->nparked) * sizeof(int));
+        recv_lane_post(rl, slot);
+        delivered++;
+    }
+
+    MPI_Testsome(COMM_RECV_SLOTS, rl->req, &outcount, indices, statuses);
+    // Os quadros casam com os MPI_Irecv na ordem de postagem, mas MPI_Testsome
+    // devolve os slots em ordem de índice: reordena para manter a ordem de chegada
+    for (int k = 1; k < outcount && outcount != MPI_UNDEFINED; k++) {
+        int slot = indices[k];
+        MPI_Status status = statuses[k];
+        int j = k;
+        for (; j > 0 && (int)(rl->posted[indices[j - 1]] - rl->posted[slot]) > 0; j--) {
+            indices[j] = indices[j - 1];
+            statuses[j] = statuses[j - 1];
+        }
+        indices[j] = slot;
+        statuses[j] = status;
+    }
+    for (int k = 0; k < outcount && outcount != MPI_UNDEFINED; k++) {
+        int slot = indices[k];
+        MPI_Get_count(&statuses[k], MPI_BYTE, &rl->len[slot]);
+        atomic_fetch_add(&lane_stats[lane].received, 1);
+        // Difusão em árvore: a subárvore não espera a entrega local
+        if (statuses[k].MPI_TAG >= FANOUT_TAG_BASE) {
+            fanout_relay(editor, pool, rl->buf[slot], rl->len[slot], statuses[k].MPI_TAG - FANOUT_TAG_BASE,
+                         lane);
+        }
+        if (rl->nparked > 0 || !recv_lane_deliver(editor, locks, lane, rl->buf[slot], rl->len[slot])) {
+            rl->parked[rl->nparked++] = slot;
+            continue;
+        }
+        recv_lane_post(rl, slot);
+        delivered++;
+    }
+
+    atomic_store(&lane_stats[lane].parked, rl->nparked);
+    stat_peak(&lane_stats[lane].parked_peak, rl->nparked);
+    return delivered;
+}
+
+/**
+ * Thread do motor de comunicação: única dona de todas as chamadas MPI
+ *
+ * Mantém COMM_RECV_SLOTS MPI_Irecv postados por canal e os completa com
+ * MPI_Testsome, o controle antes dos dados e do chat, drena a fila de
+ * saída para filas por destino, dispara MPI_Isend até o
+ * limite do pool, recolhe os envios completados e, quando não há trabalho,
+ * gira um pouco e depois
+ * dorme com backoff exponencial limitado a ENGINE_IDLE_MAX_US. Produtores
+ * acordam o motor imediatamente ao enfileirar.
+ */
+void *comm_engine(void *arg) {
+    EditorData *editor = (EditorData *)arg;
+    RecvLane lanes[COMM_LANES];
+    int idle_spins = 0;
+    int idle_us = ENGINE_IDLE_MIN_US;
+    SendPool pool;
+    LockManager locks;
+    GQueue local_backlog = G_QUEUE_INIT;
+
+    send_pool_init(&pool, editor->size);
+    memset(&locks, 0, sizeof(locks));
+    locks.lines = editor->initial_lines;
+    if (editor->edit_mode == EDIT_MODE_OPTIMISTIC) {
+        locks.versions = g_hash_table_new(g_direct_hash, g_direct_equal);
+    }
+
+    if (editor->lock_backend == LOCK_BACKEND_RMA) {
+        MPI_Win_lock_all(0, editor->lock_win);
+    }
+
+    for (int lane = 0; lane < COMM_LANES; lane++) {
+        RecvLane *rl = &lanes[lane];
+        rl->nparked = 0;
+        rl->next_post = 0;
+        rl->comm = editor->lane_comm[lane];
+        for (int i = 0; i < COMM_RECV_SLOTS; i++) {
+            rl->buf[i] = g_malloc(COMM_RECV_BUF_SIZE);
+            recv_lane_post(rl, i);
+        }
+    }
+
+    while (atomic_load(&running) || fanout_holding(editor) || !outbound_empty(&outbound_queue) ||
+           pool.queued > 0 || pool.nfree < COMM_MAX_INFLIGHT) {
+        int progress = 0;
+
+        // Mensagens para si mesmo que esperavam espaço no anel ou os dados de um commit
+        while (!g_queue_is_empty(&local_backlog)) {
+            OutboundMsg *local = g_queue_peek_head(&local_backlog);
+            if (!engine_local_ready(editor, &pool, local) ||
+                !engine_dispatch(editor, &locks, local->data, local->len)) {
+                break;
+            }
+            outbound_release(g_queue_pop_head(&local_backlog));
+            progress++;
+        }
+
+        for (int lane = 0; lane < COMM_LANES; lane++) {
+            progress += engine_poll_lane(editor, &pool, &locks, &lanes[lane], lane);
+        }
+
+        // Concessões que não foram renovadas a tempo
+        if (editor->lock_backend == LOCK_BACKEND_MSG && locks.nheld > 0 &&
+            ui_ring_free() >= LOCK_RING_RESERVE) {
+            gint64 now = g_get_monotonic_time();
+            if (now >= locks.next_sweep) {
+                lock_manager_sweep(editor, &locks, now);
+                locks.next_sweep = now + (gint64)LOCK_SWEEP_MS * 1000;
+            }
+        }
+
+        // Pedido de faixa que esperou demais na fila
+        if (locks.acquiring && locks.acq_deadline > 0 && g_get_monotonic_time() >= locks.acq_deadline &&
+            ui_ring_free() >= LOCK_RING_RESERVE) {
+            range_cancel(editor, &locks, 1);
+            progress++;
+        }
+
+        OutboundMsg *out;
+        while ((out = outbound_pop(&outbound_queue)) != NULL) {
+            engine_route(editor, &pool, &locks, &local_backlog, out);
+            progress++;
+        }
+
+        progress += send_pool_reap(&pool);
+        progress += send_pool_pump(editor, &pool);
+
+        // Exportação pronta: só depois de postar os envios pendentes (inclusive a
+        // ordem do rank 0), para nenhum rank ficar sem ela enquanto os outros gravam
+        if (atomic_load(&export_queued) > 0 && pool.queued == 0 && ui_ring_free() >= LOCK_RING_RESERVE) {
+            export_collective(editor);
+            progress++;
+        }
+
+        if (progress) {
+            idle_spins = 0;
+            idle_us = ENGINE_IDLE_MIN_US;
+        } else if (++idle_spins >= ENGINE_SPIN_ITERATIONS) {
+            engine_idle_wait(idle_us, fanout_holding(editor));
+            if (idle_us < ENGINE_IDLE_MAX_US) idle_us *= 2;
+        }
+    }
+
+    for (int lane = 0; lane < COMM_LANES; lane++) {
+        for (int i = 0; i < COMM_RECV_SLOTS; i++) {
+            if (lanes[lane].req[i] != MPI_REQUEST_NULL) {
+                MPI_Cancel(&lanes[lane].req[i]);
+                MPI_Wait(&lanes[lane].req[i], MPI_STATUS_IGNORE);
+            }
+            g_free(lanes[lane].buf[i]);
+        }
+    }
+    while (!g_queue_is_empty(&local_backlog)) {
+        outbound_release(g_queue_pop_head(&local_backlog));
+    }
+    if (editor->lock_backend == LOCK_BACKEND_RMA) {
+        MPI_Win_unlock_all(editor->lock_win);
+    }
+    g_free(pool.dests);
+    g_free(locks.held);
+    g_queue_clear_full(&locks.waiters, g_free);
+    if (locks.versions != NULL) g_hash_table_destroy(locks.versions);
+
+    return NULL;
+}
+
+/**
+ * Envia a próxima etapa das linhas geradas como um MSG_LINE_UPDATE_BATCH de
+ * até COMM_BATCH_MAX_BYTES
+ */
+void generation_send_batch(GenerationJob *job) {
+    EditorData *editor = job->editor;
+    char *chunk = g_malloc(COMM_BATCH_MAX_BYTES);
+    int used = BATCH_RECORDS_OFFSET;
+    int count = 0;
+    int token = 0;                    // só linhas livres: sem concessão
+
+    // No modo otimista o lote vai ao home das linhas: não atravessa blocos
+    int home = lock_home(editor, job->data[job->next].line_number);
+    int limit = job->count;
+    if (editor->edit_mode == EDIT_MODE_OPTIMISTIC) {
+        limit = lock_segment_end(job->data[job->next].line_number, job->count);
+    }
+
+    memcpy(chunk + sizeof(WireHeader), &token, sizeof(int));
+    memcpy(chunk + sizeof(WireHeader) + sizeof(int), &job->structure, sizeof(int));
+    while (job->next < job->count) {
+        OMPLineData *line = &job->data[job->next];
+        if (line->line_number >= limit) break;
+
+        if (line_peek(editor, line->line_number)->locked_by == -1) {
+            int next_used = batch_append(chunk, used, line->line_number, line->content);
+            if (next_used < 0) break;
+            used = next_used;
+            count++;
+        }
+        job->next++;
+    }
+
+    if (count > 0 && editor->edit_mode == EDIT_MODE_OPTIMISTIC) {
+        WireHeader header;
+        header.type = MSG_LINE_SUBMIT_BATCH;
+        header.line_number = count;
+        header.sender_rank = editor->rank;
+        header.length = used - sizeof(WireHeader);
+
+        // O home numera as versões e difunde o lote, inclusive para este rank
+        comm_send_frame(home, &header, chunk + sizeof(WireHeader));
+    } else if (count > 0) {
+        WireHeader header;
+        header.type = MSG_LINE_UPDATE_BATCH;
+        header.line_number = count;
+        header.sender_rank = editor->rank;
+        header.length = used - sizeof(WireHeader);
+
+        // Envia para outros processos
+        comm_send_frame(COMM_BROADCAST, &header, chunk + sizeof(WireHeader));
+
+        // Atualiza interface local
+        Message local;
+        local.type = MSG_LINE_UPDATE_BATCH;
+        local.line_number = count;
+        local.sender_rank = editor->rank;
+        local.args[0] = token;
+        local.args[1] = job->structure;
+
+        pthread_mutex_lock(&update_mutex);
+        ui_batch_begin(editor);
+        apply_line_batch(editor, &local, chunk + BATCH_RECORDS_OFFSET, used - BATCH_RECORDS_OFFSET);
+        ui_batch_end(editor);
+        pthread_mutex_unlock(&update_mutex);
+    }
+    g_free(chunk);
+    editor->generated += count;
+}
+
+/**
+ * Envia uma etapa das linhas geradas; pausa quando a rede sinaliza
+ * backpressure e retoma depois de GENERATION_RETRY_MS
+ * Se linhas foram inseridas ou removidas, o resto da geração (numerado
+ * antes) é abandonado.
+ */
+gboolean generation_send_step(gpointer data) {
+    GenerationJob *job = (GenerationJob *)data;
+    EditorData *editor = job->editor;
+    int renumbered = job->structure != editor->structure;
+
+    if (!renumbered) generation_send_batch(job);
+
+    if (job->next < job->count && !renumbered) {
+        if (comm_backpressure()) {
+            g_timeout_add(GENERATION_RETRY_MS, generation_send_step, job);
+            return G_SOURCE_REMOVE;
+        }
+        return G_SOURCE_CONTINUE;
+    }
+
+    free(job->data);
+    append_log(editor, renumbered ? "Geração interrompida: linhas foram inseridas ou removidas"
+                                  : "Geração concluída!");
+    editor->generating = FALSE;
+    if (job->button != NULL) gtk_widget_set_sensitive(job->button, TRUE);
+    update_status(NULL, editor);
+    g_free(job);
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Gera conteúdo para todas as linhas com OpenMP e começa a enviá-lo
+ * button (opcional) fica desabilitado até o envio terminar.
+ */
+void generation_start(EditorData *editor, GtkWidget *button) {
+    if (button != NULL) gtk_widget_set_sensitive(button, FALSE);
+    editor->generating = TRUE;
+
+    char log_msg[256];
+    sprintf(log_msg, "Iniciando geração paralela com %d threads OpenMP...", omp_get_max_threads());
+    append_log(editor, log_msg);
+
+    int count = document_line_count(&editor->doc);
+    OMPLineData *generated_data = calloc(count, sizeof(OMPLineData));
+
+    char (*log_messages)[256] = calloc(count, 256);
+    int *log_flags = calloc(count, sizeof(int));
+
+    #pragma omp parallel
+    {
+        unsigned int seed = time(NULL) + omp_get_thread_num();
+        #pragma omp for schedule(dynamic)
+        for (int i = 0; i < count; i++) {
+            generated_data[i].line_number = i;
+            generated_data[i].content[0] = '\0';
+            
+            int num_words = 5 + (rand_r(&seed) % 10);
+            for (int w = 0; w < num_words; w++) {
+                if (w > 0) strcat(generated_data[i].content, " ");
+                int word_idx = rand_r(&seed) % word_bank_size;
+                strcat(generated_data[i].content, word_bank[word_idx]);
+            }
+            
+            sprintf(log_messages[i], "Thread %d gerou dado para linha %d com %d palavras",
+                    omp_get_thread_num(), i + 1, num_words);
+            log_flags[i] = 1;
+        }
+    }
+
+    // Log das operações
+    ui_batch_begin(editor);
+    for (int i = 0; i < count; i++) {
+        if (log_flags[i]) {
+            append_log(editor, log_messages[i]);
+        }
+    }
+    ui_batch_end(editor);
+
+    free(log_messages);
+    free(log_flags);
+
+    sprintf(log_msg, "Dados gerados. Enviando atualizações...");
+    append_log(editor, log_msg);
+
+    // Envia em etapas para não travar a interface
+    GenerationJob *job = g_new(GenerationJob, 1);
+    job->editor = editor;
+    job->button = button;
+    job->data = generated_data;
+    job->count = count;
+    job->next = 0;
+    job->structure = editor->structure;
+    g_idle_add(generation_send_step, job);
+}
+
+/**
+ * Callback para geração de dados com OpenMP
+ */
+void on_generate_data_omp(GtkWidget *button, gpointer data) {
+    generation_start((EditorData *)data, button);
+}
+
+/**
+ * Faixa escolhida nos seletores: [*start, *end), com end exclusivo
+ */
+void selected_range(EditorData *editor, int *start, int *end) {
+    int first = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(editor->line_spin));
+    int last = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(editor->range_spin));
+    if (last < first) last = first;
+    *start = first - 1;
+    *end = last;
+}
+
+/**
+ * Pede a edição de [start, end): no modo de bloqueio via motor local, nos
+ * outros modos a edição começa na hora
+ */
+void editor_request_range(EditorData *editor, int start, int end) {
+    if (editor->editing_line >= 0 || editor->waiting_line >= 0) return; // Já está editando ou esperando
+
+    if (editor->edit_mode != EDIT_MODE_LOCK) {
+        // Sem ida e volta: o home confere a versão no commit, ou o CRDT funde as edições
+        editor_begin_editing(editor, start, end);
+        return;
+    }
+
+    editor->waiting_line = start;
+    editor->waiting_end = end;
+    editor->queue_position = 0;
+    if (!editor->headless) {
+        gtk_widget_set_sensitive(editor->edit_button, FALSE);
+        gtk_widget_set_sensitive(editor->cancel_button, TRUE);
+        gtk_widget_set_sensitive(editor->line_spin, FALSE);
+        gtk_widget_set_sensitive(editor->range_spin, FALSE);
+    }
+    update_status(NULL, editor);
+
+    Message msg;
+    msg.type = MSG_RANGE_LOCK;
+    msg.line_number = start;
+    msg.sender_rank = editor->rank;
+    msg.args[0] = end;
+    msg.args[1] = editor->structure;
+
+    char range[64];
+    char log_msg[256];
+    describe_range(range, sizeof(range), start, end);
+    if (editor->structure_op != 0) {
+        sprintf(log_msg, "%s pediu a %s para inserir ou remover uma linha", editor->username, range);
+    } else {
+        sprintf(log_msg, "%s solicitou edição da %s", editor->username, range);
+    }
+    append_log(editor, log_msg);
+
+    // O motor local pede a faixa aos homes, bloco por bloco
+    comm_send(editor->rank, &msg);
+}
+
+/**
+ * Callback para solicitar edição de uma linha ou faixa de linhas
+ */
+void on_edit_clicked(GtkWidget *button, gpointer data) {
+    EditorData *editor = (EditorData *)data;
+
+    int start, end;
+    selected_range(editor, &start, &end);
+    editor_request_range(editor, start, end);
+}
+
+/**
+ * Pede a inserção de uma linha vazia na posição line (type = MSG_LINE_INSERT)
+ * ou a remoção da linha line (MSG_LINE_DELETE)
+ * Antes bloqueia o fim do documento a partir da posição (ao inserir no fim,
+ * a última linha): nenhuma faixa bloqueada por outro usuário muda de
+ * número, e duas operações estruturais nunca correm juntas. Só no modo de
+ * bloqueio por mensagens, onde os homes podem deslocar o estado.
+ */
+void editor_request_structure(EditorData *editor, int type, int line) {
+    if (editor->editing_line >= 0 || editor->waiting_line >= 0) return;
+
+    if (editor->edit_mode != EDIT_MODE_LOCK || editor->lock_backend != LOCK_BACKEND_MSG) {
+        append_log(editor, "Inserir ou remover linhas só é possível no modo de bloqueio com --lock-backend=msg");
+        return;
+    }
+    int count = document_line_count(&editor->doc);
+    if (type == MSG_LINE_INSERT ? count >= MAX_DOC_LINES : count <= 1) {
+        append_log(editor, type == MSG_LINE_INSERT ? "O documento já tem o máximo de linhas"
+                                                   : "O documento precisa de pelo menos uma linha");
+        return;
+    }
+    if (line < 0 || line > (type == MSG_LINE_INSERT ? count : count - 1)) return;
+
+    editor->structure_op = type;
+    editor->structure_line = line;
+    editor_request_range(editor, line < count ? line : count - 1, count);
+}
+
+/**
+ * Callback para inserir uma linha vazia depois da linha selecionada
+ */
+void on_insert_line_clicked(GtkWidget *button, gpointer data) {
+    EditorData *editor = (EditorData *)data;
+    int start, end;
+    selected_range(editor, &start, &end);
+    editor_request_structure(editor, MSG_LINE_INSERT, start + 1);
+}
+
+/**
+ * Callback para remover a linha selecionada
+ */
+void on_delete_line_clicked(GtkWidget *button, gpointer data) {
+    EditorData *editor = (EditorData *)data;
+    int start, end;
+    selected_range(editor, &start, &end);
+    editor_request_structure(editor, MSG_LINE_DELETE, start);
+}
+
+/**
+ * Grava a cópia local do documento em save_path
+ * Cada rank tem o documento inteiro, então salvar não pede nada aos outros;
+ * update_mutex segura as atualizações remotas durante a escrita.
+ */
+void editor_save(EditorData *editor) {
+    char log_msg[512];
+
+    pthread_mutex_lock(&update_mutex);
+    int lines = document_line_count(&editor->doc);
+    int result = document_save(&editor->doc, editor->save_path);
+    pthread_mutex_unlock(&update_mutex);
+
+    if (result == 0) {
+        snprintf(log_msg, sizeof(log_msg), "Documento salvo em %s (%d linhas)", editor->save_path, lines);
+    } else {
+        snprintf(log_msg, sizeof(log_msg), "Não foi possível salvar %s: %s", editor->save_path, strerror(errno));
+    }
+    append_log(editor, log_msg);
+}
+
+/**
+ * Callback para salvar o documento
+ */
+void on_save_clicked(GtkWidget *button, gpointer data) {
+    editor_save((EditorData *)data);
+}
+
+/**
+ * Pede ao rank 0 uma exportação coletiva para save_path
+ * Cada rank grava um trecho contíguo de linhas da sua réplica no mesmo
+ * arquivo com MPI-IO, então todos precisam estar em execução.
+ */
+void editor_export(EditorData *editor) {
+    Message msg;
+    msg.type = MSG_EXPORT;
+    msg.line_number = 0;
+    msg.sender_rank = editor->rank;
+    msg.args[0] = EXPORT_REQUEST;
+    msg.args[1] = 0;
+    msg.args[2] = editor->rank;
+    msg.args[3] = 0;
+    snprintf(msg.content, MAX_LINE_LENGTH, "%s", editor->save_path);
+    comm_send(0, &msg);
+
+    editor->exports++;
+    append_log(editor, "Exportação MPI-IO pedida a todos os ranks");
+}
+
+/**
+ * Callback para exportar o documento com MPI-IO
+ */
+void on_export_clicked(GtkWidget *button, gpointer data) {
+    editor_export((EditorData *)data);
+}
+
+/**
+ * Pede a outro rank (o 0, ou o 1 para o próprio rank 0) o documento e o
+ * estado das linhas, para substituir a réplica local
+ * O que chegar durante a transferência espera e é reaplicado depois.
+ */
+void editor_request_sync(EditorData *editor) {
+    if (editor->syncing || editor->size < 2) return;
+    if (editor->editing_line >= 0 || editor->waiting_line >= 0 || editor->structure_op != 0) {
+        append_log(editor, "Termine a edição antes de sincronizar");
+        return;
+    }
+    if (editor->edit_mode == EDIT_MODE_CRDT) {
+        append_log(editor, "A sincronização não cobre o estado do modo CRDT");
+        return;
+    }
+
+    Message msg;
+    msg.type = MSG_SYNC_REQUEST;
+    msg.line_number = 0;
+    msg.sender_rank = editor->rank;
+    int donor = editor->rank == 0 ? 1 : 0;
+
+    editor->syncing = TRUE;
+    editor->sync_started = g_get_monotonic_time();
+    comm_send(donor, &msg);
+
+    char log_msg[256];
+    snprintf(log_msg, sizeof(log_msg), "Sincronização pedida a %s", user_name(editor, donor));
+    append_log(editor, log_msg);
+}
+
+/**
+ * Callback para sincronizar a réplica local com outro rank
+ */
+void on_sync_clicked(GtkWidget *button, gpointer data) {
+    editor_request_sync((EditorData *)data);
+}
+
+/**
+ * Desiste do pedido de edição que está na fila
+ */
+void editor_cancel_request(EditorData *editor) {
+    if (editor->waiting_line < 0) return;
+
+    Message msg;
+    msg.type = MSG_RANGE_CANCEL;
+    msg.line_number = editor->waiting_line;
+    msg.sender_rank = editor->rank;
+    msg.args[0] = editor->waiting_end;
+    msg.args[1] = 0;
+    comm_send(editor->rank, &msg);
+
+    if (!editor->headless) gtk_widget_set_sensitive(editor->cancel_button, FALSE);
+}
+
+/**
+ * Callback para desistir de um pedido de edição que está na fila
+ */
+void on_cancel_clicked(GtkWidget *button, gpointer data) {
+    editor_cancel_request((EditorData *)data);
+}
+
+/**
+ * Base de delta da linha em edição line (NULL se não houver)
+ */
+const char *edit_base_text(EditorData *editor, int line) {
+    if (editor->edit_text == NULL || line < editor->editing_line || line >= editor->editing_end) return NULL;
+    return editor->edit_text[line - editor->editing_line];
+}
+
+/**
+ * Envia o conteúdo das linhas de [start, end) a todos os processos
+ * Uma linha vai como MSG_LINE_UPDATE; uma faixa, em lotes MSG_LINE_UPDATE_BATCH.
+ * Cada escrita leva o token da concessão sob a qual foi feita. Linhas com
+ * pouca alteração vão só com o trecho alterado, sobre o texto de antes da
+ * edição (MSG_LINE_DELTA ou registro delta no lote).
+ */
+int commit_send_range(EditorData *editor, int start, int end) {
+    if (end - start == 1) {
+        char *content = editor_line_text(editor, start);
+        const char *base = edit_base_text(editor, start);
+        int prefix, suffix;
+        int n = base != NULL ? line_delta(base, content, &prefix, &suffix) : -1;
+        Message msg;
+        msg.type = MSG_LINE_UPDATE;
+        msg.line_number = start;
+        msg.sender_rank = editor->rank;
+        msg.args[0] = line_peek(editor, start)->token;
+        msg.args[1] = 0;              // sem versão: escrita sob bloqueio
+        msg.args[2] = editor->structure;
+        if (n >= 0) {
+            msg.type = MSG_LINE_DELTA;
+            msg.args[3] = line_checksum(base);
+            msg.args[4] = prefix;
+            msg.args[5] = suffix;
+            memcpy(msg.content, content + prefix, n);
+            msg.content[n] = '\0';
+        } else {
+            strncpy(msg.content, content, MAX_LINE_LENGTH - 1);
+            msg.content[MAX_LINE_LENGTH - 1] = '\0';
+        }
+        g_hash_table_remove(editor->refetches, GINT_TO_POINTER(start));
+        document_set_line(&editor->doc, start, content);
+        line_mark_written(editor, start, msg.args[0]);
+        journal_append(editor->journal, JOURNAL_SET, start, content);
+        g_free(content);
+        return comm_broadcast(&msg);
+    }
+
+    char *chunk = g_malloc(COMM_BATCH_MAX_BYTES);
+    int status = COMM_OK;
+    int line = start;
+
+    while (line < end) {
+        // Um lote não atravessa segmentos: cada home emite seu próprio token
+        int seg_end = lock_segment_end(line, end);
+        int token = line_peek(editor, line)->token;
+        int used = BATCH_RECORDS_OFFSET;
+        int count = 0;
+
+        memcpy(chunk + sizeof(WireHeader), &token, sizeof(int));
+        memcpy(chunk + sizeof(WireHeader) + sizeof(int), &editor->structure, sizeof(int));
+        while (line < seg_end) {
+            char *content = editor_line_text(editor, line);
+            int next_used = batch_append_delta(chunk, used, line, edit_base_text(editor, line), content);
+            // Linha que não coube: vai no próximo lote, e só então entra no documento e no diário
+            if (next_used >= 0) {
+                g_hash_table_remove(editor->refetches, GINT_TO_POINTER(line));
+                document_set_line(&editor->doc, line, content);
+                line_mark_written(editor, line, token);
+                journal_append(editor->journal, JOURNAL_SET, line, content);
+            }
+            g_free(content);
+            if (next_used < 0) break;
+            used = next_used;
+            count++;
+            line++;
+        }
+
+        WireHeader header;
+        header.type = MSG_LINE_UPDATE_BATCH;
+        header.line_number = count;
+        header.sender_rank = editor->rank;
+        header.length = used - sizeof(WireHeader);
+        if (comm_send_frame(COMM_BROADCAST, &header, chunk + sizeof(WireHeader)) == COMM_BACKPRESSURE) {
+            status = COMM_BACKPRESSURE;
+        }
+    }
+    g_free(chunk);
+    return status;
+}
+
+/**
+ * Envia ao home de cada linha de [start, end) o texto e a versão base
+ * Linhas que receberam escrita remota durante a edição já estão em
+ * conflito: voltam ao texto aceito pelo home sem ir à rede.
+ */
+void commit_optimistic(EditorData *editor, int start, int end) {
+    int conflicts = 0;
+
+    for (int line = start; line < end; line++) {
+        int i = line - start;
+        char *content = editor_line_text(editor, line);
+
+        if (line_peek(editor, line)->version != editor->edit_base[i]) {
+            char conflict_msg[MAX_LINE_LENGTH + 128];
+            snprintf(conflict_msg, sizeof(conflict_msg),
+                     "Conflito na linha %d: ela mudou durante a edição e a sua versão foi descartada: %s",
+                     line + 1, content);
+            append_log(editor, conflict_msg);
+            if (editor->edit_stash[i] != NULL) {
+                editor->p_update = TRUE;
+                editor_set_line(editor, line, editor->edit_stash[i]);
+                editor->p_update = FALSE;
+            }
+            conflicts++;
+        } else {
+            // A base da versão edit_base[i] é o texto de antes da edição
+            const char *base = editor->edit_text[i];
+            int prefix, suffix;
+            int n = line_delta(base, content, &prefix, &suffix);
+            Message msg;
+            msg.type = MSG_LINE_COMMIT;
+            msg.line_number = line;
+            msg.sender_rank = editor->rank;
+            msg.args[0] = editor->edit_base[i];
+            msg.args[1] = line_checksum(base);
+            msg.args[2] = n >= 0 ? prefix : -1;
+            msg.args[3] = n >= 0 ? suffix : 0;
+            if (n >= 0) {
+                memcpy(msg.content, content + prefix, n);
+                msg.content[n] = '\0';
+            } else {
+                strncpy(msg.content, content, MAX_LINE_LENGTH - 1);
+                msg.content[MAX_LINE_LENGTH - 1] = '\0';
+            }
+            comm_send(lock_home(editor, line), &msg);
+        }
+        g_free(content);
+    }
+
+    char range[64];
+    char log_msg[256];
+    describe_range(range, sizeof(range), start, end);
+    if (conflicts == 0) {
+        sprintf(log_msg, "%s enviou %s", editor->username, range);
+    } else {
+        sprintf(log_msg, "%s enviou %s (%d em conflito)", editor->username, range, conflicts);
+    }
+    append_log(editor, log_msg);
+}
+
+/**
+ * Confirma a edição da linha ou faixa em edição
+ */
+void editor_commit(EditorData *editor) {
+    if (editor->editing_line < 0) return; // Não está editando
 
-        case MSG_LINE_LOCK_REQUEST:
-            if (editor->lines[msg->line_number].locked_by == -1) {
-                // Concede o bloqueio
-                editor->lines[msg->line_number].locked_by = msg->sender_rank;
-                strcpy(editor->lines[msg->line_number].owner_name, msg->sender_name);
+    int start = editor->editing_line;
+    int end = editor->editing_end;
 
-                Message reply;
-                reply.type = MSG_LINE_LOCK_GRANTED;
-                reply.line_number = msg->line_number;
-                MPI_Send(&reply, sizeof(Message), MPI_BYTE, msg->sender_rank, 0, MPI_COMM_WORLD);
+    if (editor->edit_mode == EDIT_MODE_OPTIMISTIC) {
+        commit_optimistic(editor, start, end);
+        editor_end_editing(editor);
+        return;
+    }
+    if (editor->edit_mode == EDIT_MODE_CRDT) {
+        // Cada tecla já foi difundida: só encerra a edição
+        char range[64];
+        char log_msg[256];
+        describe_range(range, sizeof(range), start, end);
+        sprintf(log_msg, "%s terminou de editar %s", editor->username, range);
+        append_log(editor, log_msg);
+        editor_end_editing(editor);
+        return;
+    }
 
-                char log_msg[256];
-                sprintf(log_msg, "%s começou a editar linha %d", msg->sender_name, msg->line_number + 1);
-                append_log(editor, log_msg);
-                highlight_line(editor, msg->line_number);
-            } else {
-                // Nega o bloqueio
-                Message reply;
-                reply.type = MSG_LINE_LOCK_DENIED;
-                reply.line_number = msg->line_number;
-                reply.sender_rank = editor->lines[msg->line_number].locked_by;
-                strcpy(reply.sender_name, editor->lines[msg->line_number].owner_name);
-                MPI_Send(&reply, sizeof(Message), MPI_BYTE, msg->sender_rank, 0, MPI_COMM_WORLD);
-            }
-            break;
+    if (commit_send_range(editor, start, end) == COMM_BACKPRESSURE) {
+        append_log(editor, "Rede congestionada: o commit será entregue em segundo plano");
+    }
 
-        case MSG_LINE_LOCK_GRANTED:
-            editor->editing_line = msg->line_number;
-            editor->lines[msg->line_number].locked_by = editor->rank;
-            strcpy(editor->lines[msg->line_number].owner_name, editor->username);
-
-            // Backup da linha atual
-            char *current = get_line_content(editor->text_buffer, msg->line_number);
-            strncpy(editor->line_backup, current, MAX_LINE_LENGTH - 1);
-            g_free(current);
-
-            // Atualiza interface
-            gtk_widget_set_sensitive(editor->edit_button, FALSE);
-            gtk_widget_set_sensitive(editor->commit_button, TRUE);
-            gtk_widget_set_sensitive(editor->line_spin, FALSE);
-            gtk_text_view_set_editable(GTK_TEXT_VIEW(editor->text_view), TRUE);
-
-            highlight_line(editor, msg->line_number);
-            update_status(NULL, editor);
+    char range[64];
+    char log_msg[256];
+    describe_range(range, sizeof(range), start, end);
+    sprintf(log_msg, "%s commitou %s", editor->username, range);
+    append_log(editor, log_msg);
+
+    // Libera a faixa nos homes e restaura a interface
+    editor_release_range(editor);
+}
+
+/**
+ * Callback para confirmar edição da linha ou faixa bloqueada
+ */
+void on_commit_clicked(GtkWidget *button, gpointer data) {
+    editor_commit((EditorData *)data);
+}
+
+/**
+ * Renova periodicamente a concessão da faixa em edição
+ * Parte da thread da interface: se ela travar, o lease vence e o home
+ * recolhe as linhas.
+ */
+gboolean lease_heartbeat(gpointer data) {
+    EditorData *editor = (EditorData *)data;
+
+    if (editor->editing_line >= 0 && editor->lock_backend == LOCK_BACKEND_MSG &&
+        editor->edit_mode == EDIT_MODE_LOCK) {
+        Message msg;
+        msg.type = MSG_LOCK_HEARTBEAT;
+        msg.line_number = editor->editing_line;
+        msg.sender_rank = editor->rank;
+        msg.args[0] = editor->editing_end;
+        comm_send(editor->rank, &msg);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+/**
+ * Envia uma mensagem no chat
+ */
+void editor_send_chat(EditorData *editor, const char *text) {
+    if (strlen(text) == 0) return;
+
+    append_chat(editor, editor->username, text);
+
+    Message msg;
+    msg.type = MSG_CHAT;
+    msg.sender_rank = editor->rank;
+    strncpy(msg.content, text, MAX_LINE_LENGTH - 1);
+    comm_broadcast(&msg);
+}
+
+/**
+ * Callback para enviar mensagem no chat
+ */
+void on_chat_send(GtkWidget *entry, gpointer data) {
+    editor_send_chat((EditorData *)data, gtk_entry_get_text(GTK_ENTRY(entry)));
+    gtk_entry_set_text(GTK_ENTRY(entry), "");
+}
+
+/**
+ * Handler para cliques no editor
+ */
+gboolean on_button_press(GtkWidget *widget, GdkEventButton *event, gpointer data) {
+    EditorData *editor = (EditorData *)data;
+
+    if (editor->editing_line >= 0) {
+        gint x, y;
+        gtk_text_view_window_to_buffer_coords(GTK_TEXT_VIEW(widget),
+                                             GTK_TEXT_WINDOW_WIDGET,
+                                             event->x, event->y, &x, &y);
+
+        GtkTextIter click_iter;
+        gtk_text_view_get_iter_at_location(GTK_TEXT_VIEW(widget), &click_iter, x, y);
+
+        int clicked_line = gtk_text_iter_get_line(&click_iter);
+
+        // Bloqueia cliques fora da faixa sendo editada
+        if (clicked_line < editor->editing_line || clicked_line >= editor->editing_end) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/**
+ * Handler para teclas pressionadas
+ */
+gboolean on_key_press(GtkWidget *widget, GdkEventKey *event, gpointer data) {
+    EditorData *editor = (EditorData *)data;
+
+    if (editor->editing_line >= 0) {
+        GtkTextIter cursor;
+        GtkTextMark *mark = gtk_text_buffer_get_insert(editor->text_buffer);
+        gtk_text_buffer_get_iter_at_mark(editor->text_buffer, &cursor, mark);
+
+        int cursor_line = gtk_text_iter_get_line(&cursor);
+
+        // Bloqueia navegação com teclas para fora da faixa e quebras de linha
+        if (event->keyval == GDK_KEY_Page_Up || event->keyval == GDK_KEY_Page_Down ||
+            event->keyval == GDK_KEY_Return || event->keyval == GDK_KEY_KP_Enter) {
+            return TRUE;
+        }
+        if ((event->keyval == GDK_KEY_Up && cursor_line <= editor->editing_line) ||
+            (event->keyval == GDK_KEY_Down && cursor_line >= editor->editing_end - 1)) {
+            return TRUE;
+        }
+
+        // Reposiciona cursor se não está na faixa sendo editada
+        if (cursor_line < editor->editing_line || cursor_line >= editor->editing_end) {
+            GtkTextIter correct_pos;
+            gtk_text_buffer_get_iter_at_line(editor->text_buffer, &correct_pos, editor->editing_line);
 
-            // Posiciona cursor após o identificador
-            GtkTextIter iter;
-            gtk_text_buffer_get_iter_at_line(editor->text_buffer, &iter, msg->line_number);
-            while (!gtk_text_iter_ends_line(&iter)) {
-                if (gtk_text_iter_get_char(&iter) == '|') {
-                    gtk_text_iter_forward_char(&iter);
-                    if (gtk_text_iter_get_char(&iter) == ' ') {
-                        gtk_text_iter_forward_char(&iter);
+            while (!gtk_text_iter_ends_line(&correct_pos)) {
+                if (gtk_text_iter_get_char(&correct_pos) == '|') {
+                    gtk_text_iter_forward_char(&correct_pos);
+                    if (gtk_text_iter_get_char(&correct_pos) == ' ') {
+                        gtk_text_iter_forward_char(&correct_pos);
                     }
                     break;
                 }
-                gtk_text_iter_forward_char(&iter);
+                gtk_text_iter_forward_char(&correct_pos);
             }
-            gtk_text_buffer_place_cursor(editor->text_buffer, &iter);
-            break;
 
-        case MSG_LINE_LOCK_DENIED:
-            char denied_msg[256];
-            sprintf(denied_msg, "Linha %d já está sendo editada por %s",
-                    msg->line_number + 1, msg->sender_name);
-            append_log(editor, denied_msg);
-            update_status(NULL, editor);
-            break;
+            gtk_text_buffer_place_cursor(editor->text_buffer, &correct_pos);
+            return TRUE;
+        }
 
-        case MSG_LINE_UNLOCK:
-            if (editor->lines[msg->line_number].locked_by == msg->sender_rank) {
-                editor->lines[msg->line_number].locked_by = -1;
-                strcpy(editor->lines[msg->line_number].owner_name, "");
+        // Protege o identificador da linha
+        GtkTextIter line_start;
+        gtk_text_buffer_get_iter_at_line(editor->text_buffer, &line_start, cursor_line);
 
-                char unlock_msg[256];
-                sprintf(unlock_msg, "%s liberou linha %d", msg->sender_name, msg->line_number + 1);
-                append_log(editor, unlock_msg);
+        int cursor_offset = gtk_text_iter_get_line_offset(&cursor);
 
-                highlight_line(editor, msg->line_number);
-                update_status(NULL, editor);
+        GtkTextIter iter = line_start;
+        int pipe_pos = -1;
+        int pos = 0;
+        while (!gtk_text_iter_ends_line(&iter)) {
+            if (gtk_text_iter_get_char(&iter) == '|') {
+                pipe_pos = pos;
+                break;
             }
-            break;
-
-        case MSG_CHAT:
-            append_chat(editor, msg->sender_name, msg->content);
-            break;
+            gtk_text_iter_forward_char(&iter);
+            pos++;
+        }
 
-        case MSG_LOG_ENTRY:
-            append_log(editor, msg->content);
-            break;
+        if (pipe_pos >= 0 && cursor_offset <= pipe_pos + 1) {
+            if ((event->keyval == GDK_KEY_BackSpace && cursor_offset <= pipe_pos + 2) ||
+                (event->keyval == GDK_KEY_Delete && cursor_offset <= pipe_pos + 1)) {
+                return TRUE;
+            }
+            if (cursor_offset <= pipe_pos) {
+                return TRUE;
+            }
+        }
     }
 
-    pthread_mutex_unlock(&update_mutex);
-    g_free(update);
     return FALSE;
 }
 
 /**
- * Thread para receber mensagens MPI
+ * Handler para inserção de texto
  */
-void *mpi_receiver(void *arg) {
-    EditorData *editor = (EditorData *)arg;
-    Message msg;
-    MPI_Status status;
+void on_insert_text(GtkTextBuffer *buffer, GtkTextIter *location,
+                   gchar *text, gint len, gpointer data) {
+    EditorData *editor = (EditorData *)data;
 
-    while (running) {
-        int flag;
-        MPI_Iprobe(MPI_ANY_SOURCE, 0, MPI_COMM_WORLD, &flag, &status);
+    if (editor->editing_line >= 0) {
+        int insert_line = gtk_text_iter_get_line(location);
 
-        if (flag) {
-            MPI_Recv(&msg, sizeof(Message), MPI_BYTE, MPI_ANY_SOURCE, 0, MPI_COMM_WORLD, &status);
+        // Bloqueia inserção fora da faixa sendo editada e quebras de linha
+        if (!editor->p_update &&
+            (insert_line < editor->editing_line || insert_line >= editor->editing_end ||
+             memchr(text, '\n', len) != NULL)) {
+            g_signal_stop_emission_by_name(buffer, "insert-text");
+            return;
+        }
 
-            UpdateData *update = g_new(UpdateData, 1);
-            update->editor = editor;
-            update->msg = msg;
-            g_idle_add(update_interface, update);
+        if (!editor->p_update && editor->edit_mode == EDIT_MODE_CRDT) {
+            int offset = gtk_text_iter_get_line_offset(location) -
+                         line_prefix_length();
+            if (offset < 0 || len >= MAX_LINE_LENGTH) {
+                g_signal_stop_emission_by_name(buffer, "insert-text");
+                return;
+            }
+            crdt_local_insert(editor, insert_line, offset, text, len);
         }
+    }
+}
+
+/**
+ * Handler para remoção de texto
+ * No modo CRDT gera as remoções por caractere antes de o GTK apagar o texto.
+ */
+void on_delete_range(GtkTextBuffer *buffer, GtkTextIter *start, GtkTextIter *end, gpointer data) {
+    EditorData *editor = (EditorData *)data;
 
-        usleep(10000); // 10ms
+    if (editor->p_update || editor->edit_mode != EDIT_MODE_CRDT || editor->editing_line < 0) return;
+
+    int line = gtk_text_iter_get_line(start);
+    int content = line_prefix_length();
+    int from = gtk_text_iter_get_line_offset(start) - content;
+    int to = gtk_text_iter_get_line_offset(end) - content;
+
+    // Não junta linhas nem apaga fora da faixa ou o identificador
+    if (gtk_text_iter_get_line(end) != line || line < editor->editing_line ||
+        line >= editor->editing_end || from < 0) {
+        g_signal_stop_emission_by_name(buffer, "delete-range");
+        return;
     }
+    crdt_local_delete(editor, line, from, to);
+}
 
-    return NULL;
+/**
+ * Libera o que este rank segura nos homes e encerra o motor
+ */
+void editor_shutdown(EditorData *editor) {
+    // Libera a faixa se estiver editando
+    if (editor->editing_line >= 0) {
+        Message msg;
+        msg.type = MSG_RANGE_UNLOCK;
+        msg.line_number = editor->editing_line;
+        msg.sender_rank = editor->rank;
+        msg.args[0] = editor->editing_end;
+        comm_send(editor->rank, &msg);
+    } else if (editor->waiting_line >= 0) {
+        // Sai da fila do home
+        Message msg;
+        msg.type = MSG_RANGE_CANCEL;
+        msg.line_number = editor->waiting_line;
+        msg.sender_rank = editor->rank;
+        msg.args[0] = editor->waiting_end;
+        msg.args[1] = 0;
+        comm_send(editor->rank, &msg);
+    }
+
+    Message leave;
+    leave.type = MSG_RANK_LEAVE;
+    leave.line_number = 0;
+    leave.sender_rank = editor->rank;
+    comm_broadcast(&leave);
+    atomic_fetch_add(&fanout_left, 1);
+
+    atomic_store(&running, 0);
+    engine_wake();
 }
 
 /**
- * Callback para geração de dados com OpenMP
+ * Handler para fechamento da janela
  */
-void on_generate_data_omp(GtkWidget *button, gpointer data) {
-    EditorData *editor = (EditorData *)data;
-    gtk_widget_set_sensitive(button, FALSE);
+void on_window_destroy(GtkWidget *widget, gpointer data) {
+    editor_shutdown((EditorData *)data);
+    gtk_main_quit();
+}
+
+/**
+ * Escreve text na linha da faixa em edição, sem interface
+ * No modo CRDT a troca vira remoções e uma inserção, como se fosse digitada.
+ */
+void headless_write_line(EditorData *editor, int line, const char *text) {
+    if (line < editor->editing_line || line >= editor->editing_end) {
+        char log_msg[256];
+        sprintf(log_msg, "Linha %d fora da faixa em edição: escrita ignorada", line + 1);
+        append_log(editor, log_msg);
+        return;
+    }
+
+    if (editor->edit_mode == EDIT_MODE_CRDT) {
+        crdt_local_delete(editor, line, 0, g_utf8_strlen(document_line(&editor->doc, line), -1));
+        if (*text) crdt_local_insert(editor, line, 0, text, strlen(text));
+    } else {
+        document_set_line(&editor->doc, line, text);
+    }
+}
+
+/**
+ * Registra no log as métricas de cada canal de prioridade
+ */
+void lanes_report(EditorData *editor) {
+    for (int lane = 0; lane < COMM_LANES; lane++) {
+        LaneStats *stats = &lane_stats[lane];
+        char log_msg[256];
+        snprintf(log_msg, sizeof(log_msg),
+                 "Canal de %s: %d quadros enviados e %d recebidos; fila de envio %d (máx. %d), "
+                 "esperando o anel %d (máx. %d)",
+                 lane_names[lane], atomic_load(&stats->sent), atomic_load(&stats->received),
+                 atomic_load(&stats->queued), atomic_load(&stats->queued_peak),
+                 atomic_load(&stats->parked), atomic_load(&stats->parked_peak));
+        append_log(editor, log_msg);
+    }
+}
 
+/**
+ * Encerra a carga: libera o que estiver preso e sai do laço principal
+ */
+void headless_finish(HeadlessJob *job) {
     char log_msg[256];
-    sprintf(log_msg, "Iniciando geração paralela com %d threads OpenMP...", omp_get_max_threads());
-    append_log(editor, log_msg);
+    sprintf(log_msg, "Carga concluída: %d edições confirmadas", job->done);
+    append_log(job->editor, log_msg);
+    if (job->checks > 0) {
+        sprintf(log_msg, "Conferências do roteiro: %d de %d ok", job->checks - job->failures, job->checks);
+        append_log(job->editor, log_msg);
+    }
+    lanes_report(job->editor);
 
-    OMPLineData *generated_data = calloc(MAX_LINES, sizeof(OMPLineData));
+    editor_shutdown(job->editor);
+    g_main_loop_quit(job->loop);
+    job->finished = TRUE;
+}
 
-    char (*log_messages)[256] = calloc(MAX_LINES, 256);
-    int *log_flags = calloc(MAX_LINES, sizeof(int));
+/**
+ * Uma ação da carga aleatória: pede uma faixa ou preenche e confirma a
+ * faixa concedida; de vez em quando manda uma mensagem no chat
+ */
+void headless_random_step(HeadlessJob *job) {
+    EditorData *editor = job->editor;
+    char text[MAX_LINE_LENGTH];
 
-    #pragma omp parallel
-    {
-        unsigned int seed = time(NULL) + omp_get_thread_num();
-        #pragma omp for schedule(dynamic)
-        for (int i = 0; i < MAX_LINES; i++) {
-            generated_data[i].line_number = i;
-            generated_data[i].content[0] = '\0';
-            
-            int num_words = 5 + (rand_r(&seed) % 10);
-            for (int w = 0; w < num_words; w++) {
-                if (w > 0) strcat(generated_data[i].content, " ");
-                int word_idx = rand_r(&seed) % word_bank_size;
-                strcat(generated_data[i].content, word_bank[word_idx]);
-            }
-            
-            sprintf(log_messages[i], "Thread %d gerou dado para linha %d com %d palavras",
-                    omp_get_thread_num(), i + 1, num_words);
-            log_flags[i] = 1;
+    if (editor->editing_line >= 0) {
+        for (int line = editor->editing_line; line < editor->editing_end; line++) {
+            generate_line_content_omp(text, 0);
+            headless_write_line(editor, line, text);
         }
+        editor_commit(editor);
+        job->done++;
+        return;
+    }
+    if (job->ops_left <= 0) {
+        headless_finish(job);
+        return;
     }
+    job->ops_left--;
 
-    // Log das operações
-    for (int i = 0; i < MAX_LINES; i++) {
-        if (log_flags[i]) {
-            append_log(editor, log_messages[i]);
-        }
+    if (rand() % 10 == 0) {
+        generate_line_content_omp(text, 0);
+        editor_send_chat(editor, text);
     }
 
-    free(log_messages);
-    free(log_flags);
+    int count = document_line_count(&editor->doc);
+    int start = rand() % count;
+    int end = start + 1 + rand() % HEADLESS_MAX_RANGE;
+    editor_request_range(editor, start, end < count ? end : count);
+}
 
-    sprintf(log_msg, "Dados gerados. Enviando atualizações...");
-    append_log(editor, log_msg);
+/**
+ * Executa o roteiro até um comando que precise esperar
+ * Um comando por linha, com linhas do documento numeradas a partir de 1
+ * como na interface ('#' comenta):
+ *   edit A [B]      pede as linhas A até B
+ *   insert L        insere uma linha vazia depois da linha L (0 = no início)
+ *   delete L        remove a linha L
+ *   write L texto   escreve na linha L da faixa em edição
+ *   commit          confirma a edição
+ *   cancel          desiste do pedido na fila
+ *   chat texto      envia uma mensagem no chat
+ *   save            grava o documento (--save)
+ *   export          grava o documento com MPI-IO, todos os ranks juntos (--save)
+ *   sync            substitui a réplica local pela de outro rank
+ *   sleep MS        espera MS milissegundos
+ *   expect L texto  confere a linha L da réplica local (falhas mudam o código de saída)
+ *   diverge L texto troca a linha L só na réplica local, sem rede nem diário
+ *   crash           termina o processo na hora, sem o snapshot final do diário
+ *   quit            encerra (também ao fim do roteiro)
+ * Um comando precedido de "@R " só é executado pelo rank R, o que permite um
+ * único roteiro para todos os ranks de um cenário.
+ */
+void headless_script_step(HeadlessJob *job) {
+    EditorData *editor = job->editor;
+
+    while (job->script[job->next] != NULL) {
+        int index = job->next++;
+        char *command = g_strstrip(job->script[index]);
+        int a = 0, b = 0;
+
+        if (*command == '\0' || *command == '#') continue;
+        if (*command == '@') {
+            char *rest;
+            if (strtol(command + 1, &rest, 10) != editor->rank) continue;
+            command = g_strstrip(rest);
+        }
 
-    // Envia atualizações para todas as linhas não bloqueadas
-    for (int i = 0; i < MAX_LINES; i++) {
-        while (gtk_events_pending()) {
-            gtk_main_iteration();
+        if (sscanf(command, "edit %d %d", &a, &b) >= 1) {
+            if (b < a) b = a;
+            if (!valid_range(a - 1, b, document_line_count(&editor->doc))) {
+                char log_msg[256];
+                sprintf(log_msg, "Faixa inválida na linha %d do roteiro", index + 1);
+                append_log(editor, log_msg);
+                continue;
+            }
+            editor_request_range(editor, a - 1, b);
+            return;
+        } else if (sscanf(command, "insert %d", &a) == 1) {
+            editor_request_structure(editor, MSG_LINE_INSERT, a);
+            return;
+        } else if (sscanf(command, "delete %d", &a) == 1) {
+            editor_request_structure(editor, MSG_LINE_DELETE, a - 1);
+            return;
+        } else if (strncmp(command, "write ", 6) == 0) {
+            char *text;
+            a = strtol(command + 6, &text, 10);
+            if (*text == ' ') text++;
+            headless_write_line(editor, a - 1, text);
+        } else if (strcmp(command, "commit") == 0) {
+            if (editor->editing_line >= 0) job->done++;
+            editor_commit(editor);
+        } else if (strcmp(command, "cancel") == 0) {
+            editor_cancel_request(editor);
+            return;
+        } else if (strncmp(command, "chat ", 5) == 0) {
+            editor_send_chat(editor, command + 5);
+        } else if (strcmp(command, "save") == 0) {
+            editor_save(editor);
+        } else if (strcmp(command, "export") == 0) {
+            editor_export(editor);
+            return;
+        } else if (strcmp(command, "sync") == 0) {
+            editor_request_sync(editor);
+            return;
+        } else if (sscanf(command, "sleep %d", &a) == 1) {
+            job->resume_at = g_get_monotonic_time() + (gint64)a * 1000;
+            return;
+        } else if (strncmp(command, "expect ", 7) == 0) {
+            char *text;
+            a = strtol(command + 7, &text, 10);
+            if (*text == ' ') text++;
+            job->checks++;
+            const char *actual = a >= 1 && a <= document_line_count(&editor->doc)
+                                     ? document_line(&editor->doc, a - 1) : NULL;
+            if (actual == NULL || strcmp(actual, text) != 0) {
+                char log_msg[2 * MAX_LINE_LENGTH + 64];
+                snprintf(log_msg, sizeof(log_msg), "Linha %d difere do esperado: \"%s\" (esperado \"%s\")",
+                         a, actual != NULL ? actual : "", text);
+                append_log(editor, log_msg);
+                job->failures++;
+            }
+        } else if (strncmp(command, "diverge ", 8) == 0) {
+            // Réplica divergente de propósito, para cenários de sincronização e anti-entropia
+            char *text;
+            a = strtol(command + 8, &text, 10);
+            if (*text == ' ') text++;
+            if (a >= 1 && a <= document_line_count(&editor->doc)) document_set_line(&editor->doc, a - 1, text);
+        } else if (strcmp(command, "crash") == 0) {
+            // Queda simulada: nada de editor_shutdown nem journal_close
+            append_log(editor, "Queda simulada pelo roteiro");
+            fflush(stdout);
+            _exit(2);
+        } else if (strcmp(command, "quit") == 0) {
+            break;
+        } else {
+            char log_msg[MAX_LINE_LENGTH + 64];
+            snprintf(log_msg, sizeof(log_msg), "Comando desconhecido na linha %d do roteiro: %s",
+                     index + 1, command);
+            append_log(editor, log_msg);
         }
+    }
+    headless_finish(job);
+}
+
+/**
+ * Passo periódico da carga sem interface
+ */
+gboolean headless_step(gpointer data) {
+    HeadlessJob *job = (HeadlessJob *)data;
+
+    // Pedido na fila do home: espera a concessão, a recusa ou o prazo
+    if (job->editor->waiting_line >= 0) return G_SOURCE_CONTINUE;
+    // Inserção ou remoção de linha esperando a ordem do rank 0
+    if (job->editor->structure_op != 0) return G_SOURCE_CONTINUE;
+    // Exportação coletiva ainda gravando
+    if (job->editor->exports > 0) return G_SOURCE_CONTINUE;
+    // Snapshot de outro rank ainda chegando
+    if (job->editor->syncing) return G_SOURCE_CONTINUE;
+    if (g_get_monotonic_time() < job->resume_at) return G_SOURCE_CONTINUE;
+
+    if (job->script != NULL) {
+        headless_script_step(job);
+    } else {
+        headless_random_step(job);
+    }
+    return job->finished ? G_SOURCE_REMOVE : G_SOURCE_CONTINUE;
+}
 
-        if (editor->lines[generated_data[i].line_number].locked_by == -1) {
-            Message update_msg;
-            update_msg.type = MSG_LINE_UPDATE;
-            update_msg.line_number = generated_data[i].line_number;
-            update_msg.sender_rank = editor->rank;
-            strcpy(update_msg.sender_name, editor->username);
-            strcpy(update_msg.content, generated_data[i].content);
+/**
+ * Lê as opções de linha de comando do editor (antes de gtk_init)
+ */
+void parse_options(EditorData *editor, int argc, char *argv[]) {
+    editor->lock_backend = LOCK_BACKEND_MSG;
+    editor->lock_timeout_s = LOCK_WAIT_TIMEOUT_S;
+    editor->edit_mode = EDIT_MODE_LOCK;
+    editor->headless = FALSE;
+    editor->script_path = NULL;
+    editor->workload_ops = HEADLESS_OPS;
+    editor->think_ms = HEADLESS_THINK_MS;
+    editor->seed = time(NULL);
+    editor->bench = FALSE;
+    editor->bench_iters = BENCH_ITERS;
+    editor->bench_format = BENCH_FORMAT_CSV;
+    editor->initial_lines = DEFAULT_LINES;
+    editor->open_path = NULL;
+    editor->save_path = NULL;
+    editor->journal_dir = NULL;
+    editor->merkle_ms = MERKLE_CHECK_MS;
+    editor->fanout = FANOUT_AUTO;
+    editor->username[0] = '\0';
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--lock-backend=rma") == 0) {
+            editor->lock_backend = LOCK_BACKEND_RMA;
+        } else if (strcmp(argv[i], "--lock-backend=msg") == 0) {
+            editor->lock_backend = LOCK_BACKEND_MSG;
+        } else if (strcmp(argv[i], "--optimistic") == 0) {
+            editor->edit_mode = EDIT_MODE_OPTIMISTIC;
+        } else if (strcmp(argv[i], "--crdt") == 0) {
+            editor->edit_mode = EDIT_MODE_CRDT;
+        } else if (strncmp(argv[i], "--lock-timeout=", 15) == 0) {
+            editor->lock_timeout_s = atoi(argv[i] + 15);
+            if (editor->lock_timeout_s < 0) editor->lock_timeout_s = 0;
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            editor->headless = TRUE;
+        } else if (strncmp(argv[i], "--script=", 9) == 0) {
+            editor->script_path = argv[i] + 9;
+        } else if (strncmp(argv[i], "--ops=", 6) == 0) {
+            editor->workload_ops = atoi(argv[i] + 6);
+        } else if (strncmp(argv[i], "--think-ms=", 11) == 0) {
+            editor->think_ms = atoi(argv[i] + 11);
+            if (editor->think_ms < 0) editor->think_ms = 0;
+        } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+            editor->seed = strtoul(argv[i] + 7, NULL, 10);
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            editor->bench = TRUE;
+            editor->headless = TRUE;
+        } else if (strncmp(argv[i], "--bench-iters=", 14) == 0) {
+            editor->bench_iters = atoi(argv[i] + 14);
+            // Um relatório cabe em uma mensagem
+            int max_iters = COMM_RECV_BUF_SIZE / (int)sizeof(int) - 16;
+            if (editor->bench_iters < 1) editor->bench_iters = 1;
+            if (editor->bench_iters > max_iters) editor->bench_iters = max_iters;
+        } else if (strcmp(argv[i], "--bench-format=json") == 0) {
+            editor->bench_format = BENCH_FORMAT_JSON;
+        } else if (strcmp(argv[i], "--bench-format=csv") == 0) {
+            editor->bench_format = BENCH_FORMAT_CSV;
+        } else if (strncmp(argv[i], "--lines=", 8) == 0) {
+            editor->initial_lines = atoi(argv[i] + 8);
+            if (editor->initial_lines < 1) editor->initial_lines = 1;
+            if (editor->initial_lines > MAX_DOC_LINES) editor->initial_lines = MAX_DOC_LINES;
+        } else if (strncmp(argv[i], "--name=", 7) == 0) {
+            snprintf(editor->username, MAX_USERNAME, "%s", argv[i] + 7);
+        } else if (strncmp(argv[i], "--open=", 7) == 0) {
+            editor->open_path = argv[i] + 7;
+        } else if (strncmp(argv[i], "--save=", 7) == 0) {
+            editor->save_path = argv[i] + 7;
+        } else if (strncmp(argv[i], "--journal=", 10) == 0) {
+            editor->journal_dir = argv[i] + 10;
+        } else if (strcmp(argv[i], "--fanout=auto") == 0) {
+            editor->fanout = FANOUT_AUTO;
+        } else if (strcmp(argv[i], "--fanout=linear") == 0) {
+            editor->fanout = FANOUT_LINEAR;
+        } else if (strcmp(argv[i], "--fanout=tree") == 0) {
+            editor->fanout = FANOUT_TREE;
+        } else if (strncmp(argv[i], "--merkle-ms=", 12) == 0) {
+            editor->merkle_ms = atoi(argv[i] + 12);
+            if (editor->merkle_ms < 0) editor->merkle_ms = 0;
+        }
+    }
 
-            // Envia para outros processos
-            for (int j = 0; j < editor->size; j++) {
-                if (j != editor->rank) {
-                    MPI_Send(&update_msg, sizeof(Message), MPI_BYTE, j, 0, MPI_COMM_WORLD);
-                }
-            }
+    // Sem --save, "Salvar" grava de volta no arquivo aberto (só o rank 0 o leu)
+    if (editor->save_path == NULL) {
+        editor->save_path = editor->open_path != NULL && editor->rank == 0 ? editor->open_path
+                                                                           : DEFAULT_SAVE_PATH;
+    }
+}
 
-            // Atualiza interface local
-            UpdateData *update = g_new(UpdateData, 1);
-            update->editor = editor;
-            update->msg = update_msg;
-            g_idle_add(update_interface, update);
+/**
+ * Registra no log o início do sistema e o modo em uso
+ */
+void log_startup(EditorData *editor) {
+    append_log(editor, editor->headless ? "Sistema iniciado sem interface" : "Sistema iniciado");
+    if (editor->edit_mode == EDIT_MODE_CRDT) {
+        append_log(editor, "Modo CRDT: edições por caractere fundidas sem bloqueio");
+    } else if (editor->edit_mode == EDIT_MODE_OPTIMISTIC) {
+        append_log(editor, "Modo otimista: edição sem bloqueio, commit conferido pela versão");
+    } else if (editor->lock_backend == LOCK_BACKEND_RMA) {
+        append_log(editor, "Bloqueios via RMA (MPI_Compare_and_swap)");
+    }
+    if (fanout_use_tree(editor)) {
+        char log_msg[128];
+        snprintf(log_msg, sizeof(log_msg), "Difusões em árvore binomial entre %d ranks", editor->size);
+        append_log(editor, log_msg);
+    }
+    if (editor->journal != NULL) {
+        char log_msg[512];
+        if (editor->journal->replayed >= 0) {
+            snprintf(log_msg, sizeof(log_msg), "Documento retomado do diário em %s: %d linhas, %d registros reaplicados",
+                     editor->journal->dir, editor->initial_lines, editor->journal->replayed);
+        } else {
+            snprintf(log_msg, sizeof(log_msg), "Diário de commits em %s", editor->journal->dir);
         }
+        append_log(editor, log_msg);
+    }
+    if (editor->loaded_bytes >= 0 && (editor->journal == NULL || editor->journal->replayed < 0)) {
+        char log_msg[512];
+        if (editor->open_path != NULL) {
+            snprintf(log_msg, sizeof(log_msg), "Documento aberto de %s: %d linhas (%lld bytes)",
+                     editor->open_path, editor->initial_lines, (long long)editor->loaded_bytes);
+        } else {
+            snprintf(log_msg, sizeof(log_msg), "Documento recebido do rank 0: %d linhas (%lld bytes)",
+                     editor->initial_lines, (long long)editor->loaded_bytes);
+        }
+        append_log(editor, log_msg);
+    }
+    if (editor->truncated_lines > 0) {
+        char log_msg[128];
+        snprintf(log_msg, sizeof(log_msg), "%d linhas cortadas em %d bytes",
+                 editor->truncated_lines, MAX_LINE_LENGTH - 1);
+        append_log(editor, log_msg);
     }
-
-    free(generated_data);
-    sprintf(log_msg, "Geração concluída!");
-    append_log(editor, log_msg);
-
-    gtk_widget_set_sensitive(button, TRUE);
-    update_status(NULL, editor);
 }
 
 /**
- * Callback para solicitar edição de uma linha
+ * Inicia uma rodada de anti-entropia: compara a raiz com a do rank 0
+ * Com réplicas iguais, a rodada custa um hash em cada sentido.
  */
-void on_edit_clicked(GtkWidget *button, gpointer data) {
+gboolean merkle_tick(gpointer data) {
     EditorData *editor = (EditorData *)data;
+    int root = 1;
 
-    if (editor->editing_line >= 0) return; // Já está editando
-
-    int line_num = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(editor->line_spin)) - 1;
+    if (!atomic_load(&running)) return G_SOURCE_REMOVE;
+    if (editor->syncing || editor->structure_op != 0) return G_SOURCE_CONTINUE;
 
-    Message msg;
-    msg.type = MSG_LINE_LOCK_REQUEST;
-    msg.line_number = line_num;
-    msg.sender_rank = editor->rank;
-    strcpy(msg.sender_name, editor->username);
-
-    char log_msg[256];
-    sprintf(log_msg, "%s solicitou edição da linha %d", editor->username, line_num + 1);
-    append_log(editor, log_msg);
+    pthread_mutex_lock(&update_mutex);
+    // Resposta perdida da rodada anterior (rank 0 saindo): recomeça
+    if (editor->merkle_active) g_hash_table_remove_all(editor->merkle_seen);
+    editor->merkle_active = TRUE;
+    editor->merkle_rounds++;
+    editor->merkle_outstanding = 1;
+    editor->merkle_repaired = 0;
+    merkle_refresh(&editor->doc);
+    merkle_send(editor, 0, MERKLE_QUERY, editor->merkle_rounds, (const char *)&root, sizeof(root));
+    pthread_mutex_unlock(&update_mutex);
+    return G_SOURCE_CONTINUE;
+}
 
-    // Envia solicitação para outros processos
-    for (int i = 0; i < editor->size; i++) {
-        if (i != editor->rank) {
-            MPI_Send(&msg, sizeof(Message), MPI_BYTE, i, 0, MPI_COMM_WORLD);
-        }
+/**
+ * Inicia o motor de comunicação e os temporizadores do laço principal
+ */
+void editor_start(EditorData *editor) {
+    pthread_create(&engine_thread, NULL, comm_engine, editor);
+    g_timeout_add(LOCK_HEARTBEAT_MS, lease_heartbeat, editor);
+    g_timeout_add(LOCK_WRITTEN_KEEP_MS, released_writes_tick, editor);
+    if (editor->edit_mode == EDIT_MODE_CRDT) {
+        g_timeout_add(CRDT_GC_MS, crdt_gc_tick, editor);
     }
-
-    // Se é o único processo, concede automaticamente
-    if (editor->size == 1) {
-        UpdateData *update = g_new(UpdateData, 1);
-        update->editor = editor;
-        update->msg.type = MSG_LINE_LOCK_GRANTED;
-        update->msg.line_number = line_num;
-        g_idle_add(update_interface, update);
+    if (editor->journal != NULL) {
+        g_timeout_add(JOURNAL_SNAPSHOT_CHECK_MS, journal_tick, editor);
     }
+    // Anti-entropia: cada rank compara a sua réplica com a do rank 0
+    if (editor->rank != 0 && editor->size > 1 && editor->merkle_ms > 0 && editor->edit_mode != EDIT_MODE_CRDT) {
+        g_timeout_add(editor->merkle_ms, merkle_tick, editor);
+    }
+}
+
+int bench_compare(const void *a, const void *b) {
+    int x = *(const int *)a;
+    int y = *(const int *)b;
+    return (x > y) - (x < y);
 }
 
 /**
- * Callback para confirmar edição de uma linha
+ * Envia ao rank 0 as latências medidas por este rank no passo atual
  */
-void on_commit_clicked(GtkWidget *button, gpointer data) {
-    EditorData *editor = (EditorData *)data;
+void bench_report(BenchRun *run) {
+    EditorData *editor = run->editor;
+    char *payload = g_malloc(sizeof(int) * (run->nsamples + 1));
+
+    memcpy(payload, &run->step, sizeof(int));
+    memcpy(payload + sizeof(int), run->samples, sizeof(int) * run->nsamples);
+
+    WireHeader header;
+    header.type = MSG_BENCH_REPORT;
+    header.line_number = run->nsamples;
+    header.sender_rank = editor->rank;
+    header.length = sizeof(int) * (run->nsamples + 1);
+    comm_send_frame(0, &header, payload);
+    g_free(payload);
+
+    run->reported = TRUE;
+}
 
-    if (editor->editing_line < 0) return; // Não está editando
+/**
+ * Pede a linha da medida de bloqueio
+ */
+void bench_request_lock(BenchRun *run) {
+    EditorData *editor = run->editor;
+    int line = bench_plan[run->step].kind == BENCH_LOCK_FREE ? editor->rank % document_line_count(&editor->doc) : 0;
+
+    run->outcome = 0;
+    editor_request_range(editor, line, line + 1);
+}
 
-    char *content = get_line_content(editor->text_buffer, editor->editing_line);
+/**
+ * Rank 0: escreve a linha de medida com o tamanho do passo
+ */
+void bench_send_update(BenchRun *run) {
+    EditorData *editor = run->editor;
+    int size = bench_plan[run->step].size;
 
-    // Envia atualização
     Message msg;
     msg.type = MSG_LINE_UPDATE;
-    msg.line_number = editor->editing_line;
+    msg.line_number = document_line_count(&editor->doc) - 1;
     msg.sender_rank = editor->rank;
-    strcpy(msg.sender_name, editor->username);
-    strncpy(msg.content, content, MAX_LINE_LENGTH - 1);
-
-    for (int i = 0; i < editor->size; i++) {
-        if (i != editor->rank) {
-            MPI_Send(&msg, sizeof(Message), MPI_BYTE, i, 0, MPI_COMM_WORLD);
-        }
-    }
+    msg.args[0] = 0;
+    msg.args[1] = 0;
+    msg.args[2] = editor->structure;
+    memset(msg.content, 'u', size);
+    msg.content[size] = '\0';
+
+    run->echoes = 0;
+    run->event_at = 0;
+    run->started = g_get_monotonic_time();
+    comm_broadcast(&msg);
+}
 
-    // Libera o bloqueio
-    msg.type = MSG_LINE_UNLOCK;
-    for (int i = 0; i < editor->size; i++) {
-        if (i != editor->rank) {
-            MPI_Send(&msg, sizeof(Message), MPI_BYTE, i, 0, MPI_COMM_WORLD);
-        }
+/**
+ * Começa o passo step neste rank (step == bench_plan_size encerra)
+ */
+void bench_begin(BenchRun *run, int step) {
+    EditorData *editor = run->editor;
+
+    run->step = step;
+    run->reported = FALSE;
+    run->iter = 0;
+    run->sent = 0;
+    run->nsamples = 0;
+    run->event_at = 0;
+    run->started = g_get_monotonic_time();
+    if (editor->rank == 0) {
+        run->reports = 0;
+        run->nmerged = 0;
+        run->step_started = run->started;
     }
 
-    // Atualiza estado local
-    editor->lines[editor->editing_line].locked_by = -1;
-    strcpy(editor->lines[editor->editing_line].owner_name, "");
-    highlight_line(editor, editor->editing_line);
+    const BenchStep *plan = &bench_plan[step];
+    switch (plan->kind) {
+        case BENCH_LOCK_FREE:
+        case BENCH_LOCK_CONTENDED:
+            if (editor->edit_mode != EDIT_MODE_LOCK) {
+                bench_report(run);    // sem bloqueios neste modo
+            } else {
+                bench_request_lock(run);
+            }
+            break;
 
-    char log_msg[256];
-    sprintf(log_msg, "%s commitou linha %d", editor->username, editor->editing_line + 1);
-    append_log(editor, log_msg);
+        case BENCH_UPDATE:
+            if (editor->rank != 0) {
+                run->expect_updates += editor->bench_iters;
+            } else if (editor->size == 1) {
+                bench_report(run);
+            } else {
+                bench_send_update(run);
+            }
+            break;
 
-    // Restaura interface
-    editor->editing_line = -1;
-    gtk_widget_set_sensitive(editor->edit_button, TRUE);
-    gtk_widget_set_sensitive(editor->commit_button, FALSE);
-    gtk_widget_set_sensitive(editor->line_spin, TRUE);
-    gtk_text_view_set_editable(GTK_TEXT_VIEW(editor->text_view), FALSE);
+        case BENCH_CHAT:
+            run->expect_chats += (editor->size - 1) * editor->bench_iters;
+            break;
 
-    update_status(NULL, editor);
-    g_free(content);
+        case BENCH_GENERATION:
+            if (editor->rank == 0) {
+                generation_start(editor, NULL);
+            } else {
+                run->expect_records = -1;
+            }
+            break;
+    }
 }
 
 /**
- * Callback para enviar mensagem no chat
+ * Rank 0: resume o passo concluído a partir das latências de todos os ranks
  */
-void on_chat_send(GtkWidget *entry, gpointer data) {
-    EditorData *editor = (EditorData *)data;
-    const char *text = gtk_entry_get_text(GTK_ENTRY(entry));
+void bench_summarize(BenchRun *run) {
+    EditorData *editor = run->editor;
+    const BenchStep *plan = &bench_plan[run->step];
+    BenchResult *result = &run->results[run->step];
+    double elapsed_s = (g_get_monotonic_time() - run->step_started) / 1e6;
+
+    qsort(run->merged, run->nmerged, sizeof(int), bench_compare);
+    result->samples = run->nmerged;
+    if (run->nmerged > 0) {
+        result->p50_us = run->merged[(run->nmerged - 1) * 50 / 100];
+        result->p90_us = run->merged[(run->nmerged - 1) * 90 / 100];
+        result->p99_us = run->merged[(run->nmerged - 1) * 99 / 100];
+        result->max_us = run->merged[run->nmerged - 1];
+    }
+    result->total_ms = elapsed_s * 1000.0;
 
-    if (strlen(text) == 0) return;
+    double ops = run->nmerged;
+    if (plan->kind == BENCH_CHAT) {
+        ops = (double)editor->size * (editor->size - 1) * editor->bench_iters; // entregas
+    } else if (plan->kind == BENCH_GENERATION) {
+        ops = editor->generated;
+    }
+    result->ops_per_s = elapsed_s > 0 ? ops / elapsed_s : 0;
+}
 
-    append_chat(editor, editor->username, text);
+/**
+ * Rank 0: escreve os resultados em CSV ou JSON na saída padrão
+ */
+void bench_emit(BenchRun *run) {
+    EditorData *editor = run->editor;
+    const char *modes[] = {"lock", "optimistic", "crdt"};
 
-    Message msg;
-    msg.type = MSG_CHAT;
-    msg.sender_rank = editor->rank;
-    strcpy(msg.sender_name, editor->username);
-    strncpy(msg.content, text, MAX_LINE_LENGTH - 1);
+    if (editor->bench_format == BENCH_FORMAT_JSON) {
+        printf("{\"ranks\": %d, \"mode\": \"%s\", \"iters\": %d, \"results\": [\n",
+               editor->size, modes[editor->edit_mode], editor->bench_iters);
+    } else {
+        printf("benchmark,mode,ranks,size,samples,p50_us,p90_us,p99_us,max_us,total_ms,ops_per_s\n");
+    }
 
-    for (int i = 0; i < editor->size; i++) {
-        if (i != editor->rank) {
-            MPI_Send(&msg, sizeof(Message), MPI_BYTE, i, 0, MPI_COMM_WORLD);
+    for (int i = 0; i < bench_plan_size; i++) {
+        BenchResult *r = &run->results[i];
+        const char *name = bench_names[bench_plan[i].kind];
+        if (editor->bench_format == BENCH_FORMAT_JSON) {
+            printf("  {\"benchmark\": \"%s\", \"size\": %d, \"samples\": %d, \"p50_us\": %d, "
+                   "\"p90_us\": %d, \"p99_us\": %d, \"max_us\": %d, \"total_ms\": %.3f, "
+                   "\"ops_per_s\": %.1f}%s\n",
+                   name, bench_plan[i].size, r->samples, r->p50_us, r->p90_us, r->p99_us,
+                   r->max_us, r->total_ms, r->ops_per_s, i + 1 < bench_plan_size ? "," : "");
+        } else {
+            printf("%s,%s,%d,%d,%d,%d,%d,%d,%d,%.3f,%.1f\n", name, modes[editor->edit_mode],
+                   editor->size, bench_plan[i].size, r->samples, r->p50_us, r->p90_us, r->p99_us,
+                   r->max_us, r->total_ms, r->ops_per_s);
         }
     }
 
-    gtk_entry_set_text(GTK_ENTRY(entry), "");
+    if (editor->bench_format == BENCH_FORMAT_JSON) printf("]}\n");
+    fflush(stdout);
 }
 
 /**
- * Handler para cliques no editor
+ * Encerra o benchmark neste rank
  */
-gboolean on_button_press(GtkWidget *widget, GdkEventButton *event, gpointer data) {
-    EditorData *editor = (EditorData *)data;
-
-    if (editor->editing_line >= 0) {
-        gint x, y;
-        gtk_text_view_window_to_buffer_coords(GTK_TEXT_VIEW(widget),
-                                             GTK_TEXT_WINDOW_WIDGET,
-                                             event->x, event->y, &x, &y);
-
-        GtkTextIter click_iter;
-        gtk_text_view_get_iter_at_location(GTK_TEXT_VIEW(widget), &click_iter, x, y);
-
-        int clicked_line = gtk_text_iter_get_line(&click_iter);
+void bench_finish(BenchRun *run) {
+    if (run->editor->rank == 0) bench_emit(run);
+    editor_shutdown(run->editor);
+    g_main_loop_quit(run->loop);
+    run->finished = TRUE;
+}
 
-        // Bloqueia cliques fora da linha sendo editada
-        if (clicked_line != editor->editing_line) {
-            return TRUE;
-        }
+/**
+ * Rank 0: anuncia o passo step a todos e o começa aqui
+ */
+void bench_announce(BenchRun *run, int step) {
+    Message msg;
+    msg.type = MSG_BENCH;
+    msg.line_number = 0;
+    msg.sender_rank = run->editor->rank;
+    msg.args[0] = BENCH_OP_START;
+    msg.args[1] = step;
+    msg.args[2] = 0;
+    msg.args[3] = 0;
+    comm_broadcast(&msg);
+
+    if (step < bench_plan_size) {
+        bench_begin(run, step);
+    } else {
+        bench_finish(run);
     }
-
-    return FALSE;
 }
 
 /**
- * Handler para teclas pressionadas
+ * Avança o benchmark a cada volta do laço principal
  */
-gboolean on_key_press(GtkWidget *widget, GdkEventKey *event, gpointer data) {
-    EditorData *editor = (EditorData *)data;
-
-    if (editor->editing_line >= 0) {
-        // Bloqueia navegação com teclas
-        if (event->keyval == GDK_KEY_Up || event->keyval == GDK_KEY_Down ||
-            event->keyval == GDK_KEY_Page_Up || event->keyval == GDK_KEY_Page_Down ||
-            event->keyval == GDK_KEY_Return || event->keyval == GDK_KEY_KP_Enter) {
-            return TRUE;
+gboolean bench_tick(gpointer data) {
+    BenchRun *run = (BenchRun *)data;
+    EditorData *editor = run->editor;
+
+    if (editor->rank == 0 && run->step < 0) {
+        bench_announce(run, 0);
+    } else if (run->next_step >= 0) {
+        int step = run->next_step;
+        run->next_step = -1;
+        if (step < bench_plan_size) {
+            bench_begin(run, step);
+        } else {
+            bench_finish(run);
         }
+    }
+    if (run->finished) return G_SOURCE_REMOVE;
 
-        GtkTextIter cursor;
-        GtkTextMark *mark = gtk_text_buffer_get_insert(editor->text_buffer);
-        gtk_text_buffer_get_iter_at_mark(editor->text_buffer, &cursor, mark);
-
-        int cursor_line = gtk_text_iter_get_line(&cursor);
-
-        // Reposiciona cursor se não está na linha sendo editada
-        if (cursor_line != editor->editing_line) {
-            GtkTextIter correct_pos;
-            gtk_text_buffer_get_iter_at_line(editor->text_buffer, &correct_pos, editor->editing_line);
-
-            while (!gtk_text_iter_ends_line(&correct_pos)) {
-                if (gtk_text_iter_get_char(&correct_pos) == '|') {
-                    gtk_text_iter_forward_char(&correct_pos);
-                    if (gtk_text_iter_get_char(&correct_pos) == ' ') {
-                        gtk_text_iter_forward_char(&correct_pos);
-                    }
-                    break;
+    if (editor->rank == 0 && run->reports == editor->size) {
+        bench_summarize(run);
+        bench_announce(run, run->step + 1);
+        return run->finished ? G_SOURCE_REMOVE : G_SOURCE_CONTINUE;
+    }
+    if (run->step < 0 || run->reported) return G_SOURCE_CONTINUE;
+
+    const BenchStep *plan = &bench_plan[run->step];
+    switch (plan->kind) {
+        case BENCH_LOCK_FREE:
+        case BENCH_LOCK_CONTENDED:
+            if (run->outcome == 1) {
+                bench_push(&run->samples, &run->nsamples, &run->cap,
+                           (int)(run->event_at - run->started));
+                editor_release_range(editor);
+                if (++run->iter == editor->bench_iters) {
+                    bench_report(run);
+                } else {
+                    run->started = g_get_monotonic_time();
+                    bench_request_lock(run);
                 }
-                gtk_text_iter_forward_char(&correct_pos);
+            } else if (run->outcome == -1) {
+                bench_request_lock(run); // negado ou expirado: a medida continua
             }
+            break;
 
-            gtk_text_buffer_place_cursor(editor->text_buffer, &correct_pos);
-            return TRUE;
-        }
-
-        // Protege o identificador da linha
-        GtkTextIter line_start;
-        gtk_text_buffer_get_iter_at_line(editor->text_buffer, &line_start, editor->editing_line);
-
-        int cursor_offset = gtk_text_iter_get_line_offset(&cursor);
+        case BENCH_UPDATE:
+            if (editor->rank != 0) {
+                if (run->updates >= run->expect_updates) bench_report(run);
+            } else if (run->event_at > 0) {
+                bench_push(&run->samples, &run->nsamples, &run->cap,
+                           (int)(run->event_at - run->started));
+                if (++run->iter == editor->bench_iters) {
+                    bench_report(run);
+                } else {
+                    bench_send_update(run);
+                }
+            }
+            break;
 
-        GtkTextIter iter = line_start;
-        int pipe_pos = -1;
-        int pos = 0;
-        while (!gtk_text_iter_ends_line(&iter)) {
-            if (gtk_text_iter_get_char(&iter) == '|') {
-                pipe_pos = pos;
-                break;
+        case BENCH_CHAT: {
+            char text[MAX_LINE_LENGTH];
+            memset(text, 'c', plan->size);
+            text[plan->size] = '\0';
+            for (int k = 0; k < BENCH_CHAT_BURST && run->sent < editor->bench_iters; k++) {
+                if (comm_backpressure()) break;
+                editor_send_chat(editor, text);
+                run->sent++;
             }
-            gtk_text_iter_forward_char(&iter);
-            pos++;
+            if (run->sent == editor->bench_iters && run->chats >= run->expect_chats) bench_report(run);
+            break;
         }
 
-        if (pipe_pos >= 0 && cursor_offset <= pipe_pos + 1) {
-            if ((event->keyval == GDK_KEY_BackSpace && cursor_offset <= pipe_pos + 2) ||
-                (event->keyval == GDK_KEY_Delete && cursor_offset <= pipe_pos + 1)) {
-                return TRUE;
-            }
-            if (cursor_offset <= pipe_pos) {
-                return TRUE;
+        case BENCH_GENERATION:
+            if (editor->rank == 0) {
+                if (editor->generating) break;
+                Message msg;
+                msg.type = MSG_BENCH;
+                msg.line_number = 0;
+                msg.sender_rank = editor->rank;
+                msg.args[0] = BENCH_OP_SENT;
+                msg.args[1] = run->step;
+                msg.args[2] = editor->generated;
+                msg.args[3] = 0;
+                comm_broadcast(&msg);
+                bench_report(run);
+            } else if (run->expect_records >= 0 && run->records >= run->expect_records) {
+                bench_report(run);
             }
-        }
+            break;
     }
-
-    return FALSE;
+    return G_SOURCE_CONTINUE;
 }
 
 /**
- * Handler para inserção de texto
+ * Executa o benchmark do protocolo neste rank (sem interface)
+ * O rank 0 conduz os passos e escreve o resultado na saída padrão.
  */
-void on_insert_text(GtkTextBuffer *buffer, GtkTextIter *location,
-                   gchar *text, gint len, gpointer data) {
-    EditorData *editor = (EditorData *)data;
-
-    if (editor->editing_line >= 0) {
-        int insert_line = gtk_text_iter_get_line(location);
-
-        // Bloqueia inserção fora da linha sendo editada
-        if (insert_line != editor->editing_line && !editor->p_update) {
-            g_signal_stop_emission_by_name(buffer, "insert-text");
-        }
-    }
+void run_bench(EditorData *editor) {
+    BenchRun run;
+    memset(&run, 0, sizeof(run));
+    run.editor = editor;
+    run.step = -1;
+    run.next_step = -1;
+    run.expect_records = -1;
+    if (editor->rank == 0) run.results = g_new0(BenchResult, bench_plan_size);
+
+    run.loop = g_main_loop_new(NULL, FALSE);
+    g_bench = &run;
+    editor_start(editor);
+    g_idle_add(bench_tick, &run);
+
+    g_main_loop_run(run.loop);
+
+    g_bench = NULL;
+    g_main_loop_unref(run.loop);
+    g_free(run.samples);
+    g_free(run.merged);
+    g_free(run.results);
 }
 
 /**
- * Handler para fechamento da janela
+ * Executa o rank sem GTK: o mesmo tratamento de mensagens sobre o documento
+ * em memória, com a carga do roteiro (--script) ou aleatória (--ops)
+ * Retorna o número de conferências do roteiro que falharam.
  */
-void on_window_destroy(GtkWidget *widget, gpointer data) {
-    EditorData *editor = (EditorData *)data;
-
-    // Libera linha se estiver editando
-    if (editor->editing_line >= 0) {
-        Message msg;
-        msg.type = MSG_LINE_UNLOCK;
-        msg.line_number = editor->editing_line;
-        msg.sender_rank = editor->rank;
-
-        for (int i = 0; i < editor->size; i++) {
-            if (i != editor->rank) {
-                MPI_Send(&msg, sizeof(Message), MPI_BYTE, i, 0, MPI_COMM_WORLD);
-            }
+int run_headless(EditorData *editor) {
+    HeadlessJob job;
+    memset(&job, 0, sizeof(job));
+    job.editor = editor;
+    job.ops_left = editor->workload_ops;
+
+    if (editor->script_path != NULL) {
+        char *contents;
+        if (!g_file_get_contents(editor->script_path, &contents, NULL, NULL)) {
+            fprintf(stderr, "Não foi possível ler o roteiro %s\n", editor->script_path);
+            MPI_Abort(MPI_COMM_WORLD, 1);
         }
+        job.script = g_strsplit(contents, "\n", -1);
+        g_free(contents);
     }
+    srand(editor->seed + editor->rank);
 
-    running = 0;
-    gtk_main_quit();
-}
-
-int main(int argc, char *argv[]) {
-    // Inicialização MPI
-    MPI_Init(&argc, &argv);
-
-    EditorData editor;
-    MPI_Comm_rank(MPI_COMM_WORLD, &editor.rank);
-    MPI_Comm_size(MPI_COMM_WORLD, &editor.size);
-
-    // Configuração inicial
-    if (editor.rank == 0) {
-        strcpy(editor.username, "MASTER");
-    } else {
-        sprintf(editor.username, "Usuário %d", editor.rank);
-    }
-    editor.editing_line = -1;
+    job.loop = g_main_loop_new(NULL, FALSE);
+    log_startup(editor);
+    editor_start(editor);
+    g_timeout_add(editor->think_ms, headless_step, &job);
 
-    // Inicializa array de linhas
-    for (int i = 0; i < MAX_LINES; i++) {
-        editor.lines[i].locked_by = -1;
-        strcpy(editor.lines[i].owner_name, "");
-    }
+    g_main_loop_run(job.loop);
 
-    g_editor = &editor;
+    g_main_loop_unref(job.loop);
+    g_strfreev(job.script);
+    return job.failures;
+}
 
+/**
+ * Monta a janela e executa o laço principal do GTK
+ */
+void run_gui(EditorData *editor, int *argc, char ***argv) {
     // Inicialização GTK
-    gtk_init(&argc, &argv);
+    gtk_init(argc, argv);
 
     // Janela principal
-    editor.window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
-    gtk_window_set_title(GTK_WINDOW(editor.window), editor.username);
-    gtk_window_set_default_size(GTK_WINDOW(editor.window), 900, 700);
+    editor->window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+    gtk_window_set_title(GTK_WINDOW(editor->window), editor->username);
+    gtk_window_set_default_size(GTK_WINDOW(editor->window), 900, 700);
 
     // Layout principal (horizontal)
     GtkWidget *main_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
-    gtk_container_add(GTK_CONTAINER(editor.window), main_box);
+    gtk_container_add(GTK_CONTAINER(editor->window), main_box);
 
     // Lado esquerdo (editor + controles)
     GtkWidget *left_box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 5);
@@ -770,19 +7007,44 @@ int main(int argc, char *argv[]) {
 
     gtk_box_pack_start(GTK_BOX(control_box), gtk_label_new("Linha:"), FALSE, FALSE, 5);
 
-    editor.line_spin = gtk_spin_button_new_with_range(1, MAX_LINES, 1);
-    gtk_box_pack_start(GTK_BOX(control_box), editor.line_spin, FALSE, FALSE, 5);
+    int count = document_line_count(&editor->doc);
+    editor->line_spin = gtk_spin_button_new_with_range(1, count, 1);
+    gtk_box_pack_start(GTK_BOX(control_box), editor->line_spin, FALSE, FALSE, 5);
+
+    gtk_box_pack_start(GTK_BOX(control_box), gtk_label_new("até"), FALSE, FALSE, 5);
+
+    editor->range_spin = gtk_spin_button_new_with_range(1, count, 1);
+    gtk_box_pack_start(GTK_BOX(control_box), editor->range_spin, FALSE, FALSE, 5);
+
+    editor->edit_button = gtk_button_new_with_label("Editar Linha");
+    gtk_box_pack_start(GTK_BOX(control_box), editor->edit_button, FALSE, FALSE, 5);
 
-    editor.edit_button = gtk_button_new_with_label("Editar Linha");
-    gtk_box_pack_start(GTK_BOX(control_box), editor.edit_button, FALSE, FALSE, 5);
+    editor->commit_button = gtk_button_new_with_label("Commit Linha");
+    gtk_widget_set_sensitive(editor->commit_button, FALSE);
+    gtk_box_pack_start(GTK_BOX(control_box), editor->commit_button, FALSE, FALSE, 5);
+
+    editor->cancel_button = gtk_button_new_with_label("Cancelar Pedido");
+    gtk_widget_set_sensitive(editor->cancel_button, FALSE);
+    gtk_box_pack_start(GTK_BOX(control_box), editor->cancel_button, FALSE, FALSE, 5);
 
-    editor.commit_button = gtk_button_new_with_label("Commit Linha");
-    gtk_widget_set_sensitive(editor.commit_button, FALSE);
-    gtk_box_pack_start(GTK_BOX(control_box), editor.commit_button, FALSE, FALSE, 5);
+    GtkWidget *insert_button = gtk_button_new_with_label("Inserir Linha");
+    gtk_box_pack_start(GTK_BOX(control_box), insert_button, FALSE, FALSE, 5);
+
+    GtkWidget *delete_button = gtk_button_new_with_label("Remover Linha");
+    gtk_box_pack_start(GTK_BOX(control_box), delete_button, FALSE, FALSE, 5);
 
     GtkWidget *generate_button = gtk_button_new_with_label("Gerar Dados OpenMP");
     gtk_box_pack_start(GTK_BOX(control_box), generate_button, FALSE, FALSE, 5);
 
+    GtkWidget *save_button = gtk_button_new_with_label("Salvar");
+    gtk_box_pack_start(GTK_BOX(control_box), save_button, FALSE, FALSE, 5);
+
+    GtkWidget *export_button = gtk_button_new_with_label("Exportar MPI-IO");
+    gtk_box_pack_start(GTK_BOX(control_box), export_button, FALSE, FALSE, 5);
+
+    GtkWidget *sync_button = gtk_button_new_with_label("Sincronizar");
+    gtk_box_pack_start(GTK_BOX(control_box), sync_button, FALSE, FALSE, 5);
+
     // Editor de texto
     GtkWidget *editor_frame = gtk_frame_new("Editor (Verde=você | Rosa=outro usuário)");
     gtk_box_pack_start(GTK_BOX(left_box), editor_frame, TRUE, TRUE, 0);
@@ -790,21 +7052,15 @@ int main(int argc, char *argv[]) {
     GtkWidget *scrolled = gtk_scrolled_window_new(NULL, NULL);
     gtk_container_add(GTK_CONTAINER(editor_frame), scrolled);
 
-    editor.text_view = gtk_text_view_new();
-    editor.text_buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(editor.text_view));
-    gtk_text_view_set_editable(GTK_TEXT_VIEW(editor.text_view), FALSE);
-    gtk_container_add(GTK_CONTAINER(scrolled), editor.text_view);
+    editor->text_view = gtk_text_view_new();
+    editor->text_buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(editor->text_view));
+    gtk_text_buffer_create_tag(editor->text_buffer, "mine", "background", "#90EE90", NULL);
+    gtk_text_buffer_create_tag(editor->text_buffer, "other", "background", "#FFB6C1", NULL);
+    gtk_text_view_set_editable(GTK_TEXT_VIEW(editor->text_view), FALSE);
+    gtk_container_add(GTK_CONTAINER(scrolled), editor->text_view);
 
     // Texto inicial (numeração das linhas)
-    char initial_text[MAX_LINES * 10];
-    strcpy(initial_text, "");
-    for (int i = 0; i < MAX_LINES; i++) {
-        char line[10];
-        int length_max_lines = floor(log10(MAX_LINES)) + 1;
-        sprintf(line, "%0*d| \n", length_max_lines, i + 1);
-        strcat(initial_text, line);
-    }
-    gtk_text_buffer_set_text(editor.text_buffer, initial_text, -1);
+    view_reset(editor);
 
     // Log de atividades
     GtkWidget *log_frame = gtk_frame_new("Log de Atividades");
@@ -814,10 +7070,10 @@ int main(int argc, char *argv[]) {
     gtk_scrolled_window_set_min_content_height(GTK_SCROLLED_WINDOW(log_scrolled), 100);
     gtk_container_add(GTK_CONTAINER(log_frame), log_scrolled);
 
-    editor.log_view = gtk_text_view_new();
-    editor.log_buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(editor.log_view));
-    gtk_text_view_set_editable(GTK_TEXT_VIEW(editor.log_view), FALSE);
-    gtk_container_add(GTK_CONTAINER(log_scrolled), editor.log_view);
+    editor->log_view = gtk_text_view_new();
+    editor->log_buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(editor->log_view));
+    gtk_text_view_set_editable(GTK_TEXT_VIEW(editor->log_view), FALSE);
+    gtk_container_add(GTK_CONTAINER(log_scrolled), editor->log_view);
 
     // Chat (lado direito)
     GtkWidget *chat_frame = gtk_frame_new("Chat entre Usuários");
@@ -830,48 +7086,186 @@ int main(int argc, char *argv[]) {
     GtkWidget *chat_scrolled = gtk_scrolled_window_new(NULL, NULL);
     gtk_box_pack_start(GTK_BOX(chat_box), chat_scrolled, TRUE, TRUE, 5);
 
-    editor.chat_view = gtk_text_view_new();
-    editor.chat_buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(editor.chat_view));
-    gtk_text_view_set_editable(GTK_TEXT_VIEW(editor.chat_view), FALSE);
-    gtk_text_view_set_wrap_mode(GTK_TEXT_VIEW(editor.chat_view), GTK_WRAP_WORD);
-    gtk_container_add(GTK_CONTAINER(chat_scrolled), editor.chat_view);
+    editor->chat_view = gtk_text_view_new();
+    editor->chat_buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(editor->chat_view));
+    gtk_text_view_set_editable(GTK_TEXT_VIEW(editor->chat_view), FALSE);
+    gtk_text_view_set_wrap_mode(GTK_TEXT_VIEW(editor->chat_view), GTK_WRAP_WORD);
+    gtk_container_add(GTK_CONTAINER(chat_scrolled), editor->chat_view);
 
-    editor.chat_entry = gtk_entry_new();
-    gtk_entry_set_placeholder_text(GTK_ENTRY(editor.chat_entry), "Digite sua mensagem...");
-    gtk_box_pack_start(GTK_BOX(chat_box), editor.chat_entry, FALSE, FALSE, 5);
+    editor->chat_entry = gtk_entry_new();
+    gtk_entry_set_placeholder_text(GTK_ENTRY(editor->chat_entry), "Digite sua mensagem...");
+    gtk_box_pack_start(GTK_BOX(chat_box), editor->chat_entry, FALSE, FALSE, 5);
 
     // Status
-    editor.status_label = gtk_label_new("Selecione uma linha para editar");
-    gtk_box_pack_start(GTK_BOX(left_box), editor.status_label, FALSE, FALSE, 5);
-
-    g_signal_connect(editor.edit_button, "clicked", G_CALLBACK(on_edit_clicked), &editor);
-    g_signal_connect(editor.commit_button, "clicked", G_CALLBACK(on_commit_clicked), &editor);
-    g_signal_connect(editor.chat_entry, "activate", G_CALLBACK(on_chat_send), &editor);
-    g_signal_connect(editor.text_view, "key-press-event", G_CALLBACK(on_key_press), &editor);
-    g_signal_connect(editor.window, "destroy", G_CALLBACK(on_window_destroy), &editor);
-    g_signal_connect(editor.line_spin, "value-changed", G_CALLBACK(update_status), &editor);
-    g_signal_connect(editor.text_view, "button-press-event", G_CALLBACK(on_button_press), &editor);
-    g_signal_connect(editor.text_buffer, "insert-text", G_CALLBACK(on_insert_text), &editor);
-    g_signal_connect(generate_button, "clicked", G_CALLBACK(on_generate_data_omp), &editor);
-
-    editor.p_update = FALSE;
+    editor->status_label = gtk_label_new("Selecione uma linha para editar");
+    gtk_box_pack_start(GTK_BOX(left_box), editor->status_label, FALSE, FALSE, 5);
+
+    g_signal_connect(editor->edit_button, "clicked", G_CALLBACK(on_edit_clicked), editor);
+    g_signal_connect(editor->commit_button, "clicked", G_CALLBACK(on_commit_clicked), editor);
+    g_signal_connect(editor->cancel_button, "clicked", G_CALLBACK(on_cancel_clicked), editor);
+    g_signal_connect(insert_button, "clicked", G_CALLBACK(on_insert_line_clicked), editor);
+    g_signal_connect(delete_button, "clicked", G_CALLBACK(on_delete_line_clicked), editor);
+    g_signal_connect(editor->chat_entry, "activate", G_CALLBACK(on_chat_send), editor);
+    g_signal_connect(editor->text_view, "key-press-event", G_CALLBACK(on_key_press), editor);
+    g_signal_connect(editor->window, "destroy", G_CALLBACK(on_window_destroy), editor);
+    g_signal_connect(editor->line_spin, "value-changed", G_CALLBACK(update_status), editor);
+    g_signal_connect(editor->text_view, "button-press-event", G_CALLBACK(on_button_press), editor);
+    g_signal_connect(editor->text_buffer, "insert-text", G_CALLBACK(on_insert_text), editor);
+    g_signal_connect(editor->text_buffer, "delete-range", G_CALLBACK(on_delete_range), editor);
+    g_signal_connect(generate_button, "clicked", G_CALLBACK(on_generate_data_omp), editor);
+    g_signal_connect(save_button, "clicked", G_CALLBACK(on_save_clicked), editor);
+    g_signal_connect(export_button, "clicked", G_CALLBACK(on_export_clicked), editor);
+    g_signal_connect(sync_button, "clicked", G_CALLBACK(on_sync_clicked), editor);
 
     // Log inicial
-    append_log(&editor, "Sistema iniciado");
-    append_chat(&editor, "Sistema", "Chat iniciado. Todos os usuários podem conversar aqui.");
+    log_startup(editor);
+    append_chat(editor, "Sistema", "Chat iniciado. Todos os usuários podem conversar aqui.");
 
-    update_status(NULL, &editor);
-    gtk_widget_show_all(editor.window);
+    update_status(NULL, editor);
+    gtk_widget_show_all(editor->window);
 
-    // Inicia thread MPI
-    pthread_create(&receiver_thread, NULL, mpi_receiver, &editor);
+    editor_start(editor);
 
     // Loop principal GTK
     gtk_main();
+}
+
+int main(int argc, char *argv[]) {
+    // Inicialização MPI (somente a thread do motor chama MPI depois do setup)
+    int provided;
+    int status = 0;                   // código de saída: conferências do roteiro que falharam
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_SERIALIZED, &provided);
+    if (provided < MPI_THREAD_SERIALIZED) {
+        fprintf(stderr, "A implementação MPI não suporta MPI_THREAD_SERIALIZED\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    EditorData editor;
+    MPI_Comm_rank(MPI_COMM_WORLD, &editor.rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &editor.size);
+    parse_options(&editor, argc, argv);
+
+    // Todos os ranks precisam usar o mesmo backend de bloqueio, modo e tamanho inicial
+    int config[3] = {editor.lock_backend, editor.edit_mode, editor.initial_lines};
+    int config_min[3], config_max[3];
+    MPI_Allreduce(config, config_min, 3, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    MPI_Allreduce(config, config_max, 3, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    if (config_min[0] != config_max[0] || config_min[1] != config_max[1] ||
+        config_min[2] != config_max[2]) {
+        if (editor.rank == 0) {
+            fprintf(stderr, "Todos os ranks devem usar o mesmo --lock-backend, modo de edição e --lines\n");
+        }
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    // Documento inicial (--journal ou --open definem o número de linhas antes das janelas RMA)
+    editor.journal = NULL;
+    if (editor.rank == 0 && editor.journal_dir != NULL) {
+        journal_prepare(&editor);
+    }
+    document_distribute(&editor);
+    if (editor.journal != NULL) {
+        journal_start(&editor);
+    }
+    editor.lock_win = MPI_WIN_NULL;
+    if (editor.lock_backend == LOCK_BACKEND_RMA) {
+        rma_locks_init(&editor);
+    }
+    // Um comunicador por canal: o tráfego de um não casa com os Irecv de outro
+    for (int lane = 0; lane < COMM_LANES; lane++) {
+        MPI_Comm_dup(MPI_COMM_WORLD, &editor.lane_comm[lane]);
+    }
+
+    // Configuração inicial (nome padrão se não veio --name)
+    if (editor.username[0] == '\0' && editor.rank == 0) {
+        strcpy(editor.username, "MASTER");
+    } else if (editor.username[0] == '\0') {
+        sprintf(editor.username, "Usuário %d", editor.rank);
+    }
+    editor.editing_line = -1;
+    editor.editing_end = -1;
+    editor.waiting_line = -1;
+    editor.edit_base = NULL;
+    editor.edit_stash = NULL;
+    editor.edit_text = NULL;
+    editor.crdt_lines = NULL;
+    g_queue_init(&editor.crdt_pending);
+    editor.line_state = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+    editor.refetches = g_hash_table_new(g_direct_hash, g_direct_equal);
+    editor.refetch_next = 0;
+    editor.released_writes = g_hash_table_new(g_direct_hash, g_direct_equal);
+    editor.released_before = g_hash_table_new(g_direct_hash, g_direct_equal);
+    editor.structure = 0;
+    editor.structure_op = 0;
+    editor.exports = 0;
+    editor.syncing = FALSE;
+    editor.merkle_rounds = 0;
+    editor.merkle_active = FALSE;
+    editor.merkle_suspects = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+    editor.merkle_seen = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+    editor.sync_data = NULL;
+    g_queue_init(&editor.sync_pending);
+    g_queue_init(&editor.structure_pending);
+    if (editor.edit_mode == EDIT_MODE_CRDT) {
+        editor.crdt_lines = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, crdt_line_free);
+        editor.crdt_clock = 0;
+        editor.crdt_seen = g_new0(int, editor.size);
+        editor.crdt_reports = g_new0(int, editor.size * editor.size);
+        editor.crdt_seen_dirty = FALSE;
+    }
+    init_user_names(&editor);
+
+    g_editor = &editor;
+    outbound_init(&outbound_queue);
+
+    editor.p_update = FALSE;
+    editor.batching = FALSE;
+    editor.generating = FALSE;
+    editor.generated = 0;
+
+    if (editor.bench) {
+        run_bench(&editor);
+    } else if (editor.headless) {
+        status = run_headless(&editor) > 0;
+    } else {
+        run_gui(&editor, &argc, &argv);
+    }
 
     // Limpeza
-    pthread_join(receiver_thread, NULL);
+    pthread_join(engine_thread, NULL);
+    if (editor.lock_win != MPI_WIN_NULL) {
+        MPI_Win_free(&editor.lock_win);
+    }
+    for (int lane = 0; lane < COMM_LANES; lane++) {
+        MPI_Comm_free(&editor.lane_comm[lane]);
+    }
+    if (editor.crdt_lines != NULL) {
+        g_hash_table_destroy(editor.crdt_lines);
+        g_free(editor.crdt_seen);
+        g_free(editor.crdt_reports);
+        g_queue_clear_full(&editor.crdt_pending, g_free);
+    }
+    while (!g_queue_is_empty(&editor.structure_pending)) {
+        UiSlot *slot = g_queue_pop_head(&editor.structure_pending);
+        g_free(slot->payload);
+        g_free(slot);
+    }
+    while (!g_queue_is_empty(&editor.sync_pending)) {
+        UiSlot *slot = g_queue_pop_head(&editor.sync_pending);
+        g_free(slot->payload);
+        g_free(slot);
+    }
+    g_free(editor.sync_data);
+    g_hash_table_destroy(editor.merkle_suspects);
+    g_hash_table_destroy(editor.merkle_seen);
+    if (editor.journal != NULL) {
+        journal_close(&editor);
+    }
+    g_hash_table_destroy(editor.line_state);
+    g_hash_table_destroy(editor.refetches);
+    g_hash_table_destroy(editor.released_writes);
+    g_hash_table_destroy(editor.released_before);
+    document_free(&editor.doc);
     MPI_Finalize();
 
-    return 0;
+    return status;
 }